@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Counts the heap allocations made by a program, for test_alloc.sh. Loaded
+ * with LD_PRELOAD, it wraps the allocation functions of the C library and
+ * writes the number of calls to the file named by $ALLOC_COUNT_FILE when the
+ * program exits. Children forked by the program are not counted.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static pid_t counted_pid;
+static unsigned long count;
+
+static void count_call(void) {
+    if (getpid() == counted_pid) {
+        count++;
+    }
+}
+
+__attribute__((constructor)) static void start_counting(void) {
+    counted_pid = getpid();
+}
+
+__attribute__((destructor)) static void write_count(void) {
+    const char *path = getenv("ALLOC_COUNT_FILE");
+    if (path == NULL || getpid() != counted_pid) {
+        return;
+    }
+    // Opening the file allocates too
+    unsigned long total = count;
+    FILE *f = fopen(path, "w");
+    if (f != NULL) {
+        fprintf(f, "%lu\n", total);
+        fclose(f);
+    }
+}
+
+void *malloc(size_t size) {
+    count_call();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    count_call();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    count_call();
+    return __libc_realloc(p, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count_call();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size) {
+    count_call();
+    *p = __libc_memalign(alignment, size);
+    return *p != NULL ? 0 : ENOMEM;
+}
@@ -0,0 +1,86 @@
+#include <stdalign.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ALIGNMENT alignof(max_align_t)
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+static struct arena_block *block_new(size_t size) {
+    struct arena_block *block = malloc(sizeof(struct arena_block) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+int arena_init(arena_t *arena, size_t size) {
+    arena->blocks = block_new(size);
+    arena->total = size;
+    return arena->blocks == NULL;
+}
+
+void arena_free(arena_t *arena) {
+    while (arena->blocks != NULL) {
+        struct arena_block *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->total = 0;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    struct arena_block *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        // Blocks at least double, so a line needs few of them
+        size_t block_size = block == NULL ? size : 2 * block->size;
+        if (block_size < size) {
+            block_size = size;
+        }
+        if ((block = block_new(block_size)) == NULL) {
+            return NULL;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->total += block_size;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+void arena_reset(arena_t *arena) {
+    struct arena_block *block = arena->blocks;
+    if (block == NULL) {
+        return;
+    }
+    if (block->next != NULL) {
+        // Replace the blocks with one that fits everything they held. If that
+        // cannot be allocated, keep the newest, which is the largest.
+        struct arena_block *merged = block_new(arena->total);
+        struct arena_block *rest = merged != NULL ? block : block->next;
+        if (merged != NULL) {
+            arena->blocks = merged;
+        } else {
+            block->next = NULL;
+            arena->total = block->size;
+        }
+        while (rest != NULL) {
+            struct arena_block *next = rest->next;
+            free(rest);
+            rest = next;
+        }
+        block = arena->blocks;
+    }
+    block->used = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+/*
+ * Bump allocator for memory that all dies at once, such as everything built
+ * while running one command line. Allocations are carved out of large blocks
+ * and are never freed individually; resetting the arena releases them all.
+ * A reset keeps the memory for reuse, and merges the blocks into one large
+ * enough for everything allocated since the previous reset, so once lines of
+ * a given size have been seen, running them allocates nothing.
+ */
+typedef struct {
+    struct arena_block *blocks;  // Newest first; allocations come from the first
+    size_t total;                // Size of all blocks together
+} arena_t;
+
+/*
+ * Initializes a new arena
+ * arena: Pointer to the arena to initialize
+ * size: Size of the first block
+ * Returns 0 on success, 1 on error
+ */
+int arena_init(arena_t *arena, size_t size);
+
+/*
+ * Releases all memory held by an arena
+ * arena: Pointer to the arena to free
+ */
+void arena_free(arena_t *arena);
+
+/*
+ * Allocate memory from an arena, aligned for any type
+ * arena: Pointer to the arena
+ * size: Number of bytes to allocate
+ * Returns the memory, valid until the arena is reset, or NULL on error
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/*
+ * Release everything allocated from an arena, keeping its memory for reuse
+ * arena: Pointer to the arena
+ */
+void arena_reset(arena_t *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "jobs.h"
+#include "lastout.h"
+#include "onchange.h"
+#include "shell_funcs.h"
+#include "watch.h"
+
+#define WATCH_INTERVAL 2.0
+#define MIN_WATCH_INTERVAL 0.1
+
+typedef int (*builtin_fn)(builtin_ctx_t *ctx, strvec_t *tokens);
+
+/*
+ * Report a failed directory change in the form "cd: target: reason"
+ * Returns 1
+ */
+static int dir_error(const char *name, const char *target) {
+    if (target != NULL) {
+        fprintf(stderr, "%s: %s: %s\n", name, target, strerror(errno));
+    } else {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    }
+    return 1;
+}
+
+static int builtin_cd(builtin_ctx_t *ctx, strvec_t *tokens) {
+    if (tokens->length > 2) {
+        fprintf(stderr, "cd: too many arguments\n");
+        return 1;
+    }
+    const char *target = strvec_get(tokens, 1);
+    if (target == NULL) {
+        target = getenv("HOME");
+        if (target == NULL) {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+    }
+    if (dirs_cd(ctx->dirs, target) != 0) {
+        return dir_error("cd", target);
+    }
+    if (strcmp(target, "-") == 0) {
+        printf("%s\n", ctx->dirs->cwd.path != NULL ? ctx->dirs->cwd.path : ".");
+    }
+    return 0;
+}
+
+static int builtin_pushd(builtin_ctx_t *ctx, strvec_t *tokens) {
+    if (tokens->length > 2) {
+        fprintf(stderr, "pushd: too many arguments\n");
+        return 1;
+    }
+    const char *target = strvec_get(tokens, 1);
+    if (dirs_push(ctx->dirs, target) != 0) {
+        return dir_error("pushd", target);
+    }
+    dirs_print(ctx->dirs);
+    return 0;
+}
+
+static int builtin_popd(builtin_ctx_t *ctx, strvec_t *tokens) {
+    if (tokens->length > 1) {
+        fprintf(stderr, "popd: too many arguments\n");
+        return 1;
+    }
+    if (dirs_pop(ctx->dirs) != 0) {
+        return dir_error("popd", NULL);
+    }
+    dirs_print(ctx->dirs);
+    return 0;
+}
+
+static int builtin_dirs(builtin_ctx_t *ctx, strvec_t *tokens) {
+    dirs_print(ctx->dirs);
+    return 0;
+}
+
+static int builtin_z(builtin_ctx_t *ctx, strvec_t *tokens) {
+    if (tokens->length > 2) {
+        fprintf(stderr, "z: too many arguments\n");
+        return 1;
+    }
+    const char *fragment = strvec_get(tokens, 1);
+    if (fragment == NULL) {
+        if (ctx->dirs->have_frecency) {
+            frecency_print(&ctx->dirs->frecency);
+        }
+        return 0;
+    }
+    if (dirs_jump(ctx->dirs, fragment) != 0) {
+        return dir_error("z", fragment);
+    }
+    return 0;
+}
+
+static int builtin_watch(builtin_ctx_t *ctx, strvec_t *tokens) {
+    double interval = WATCH_INTERVAL;
+    unsigned start = 1;
+    const char *option = strvec_get(tokens, 1);
+    if (option != NULL && strcmp(option, "-n") == 0) {
+        const char *value = strvec_get(tokens, 2);
+        char *end = NULL;
+        if (value != NULL) {
+            interval = strtod(value, &end);
+        }
+        if (value == NULL || end == value || *end != '\0' || !(interval > 0)) {
+            fprintf(stderr, "watch: invalid interval\n");
+            return 1;
+        }
+        if (interval < MIN_WATCH_INTERVAL) {
+            interval = MIN_WATCH_INTERVAL;
+        }
+        start = 3;
+    }
+    if (start >= tokens->length) {
+        fprintf(stderr, "usage: watch [-n SECONDS] COMMAND\n");
+        return 1;
+    }
+
+    // The header shows the command as typed
+    size_t len = 0;
+    for (unsigned i = start; i < tokens->length; i++) {
+        len += strlen(strvec_get(tokens, i)) + 1;
+    }
+    char *title = arena_alloc(ctx->arena, len);
+    if (title == NULL) {
+        fprintf(stderr, "watch: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    title[0] = '\0';
+    for (unsigned i = start; i < tokens->length; i++) {
+        if (i > start) {
+            strcat(title, " ");
+        }
+        strcat(title, strvec_get(tokens, i));
+    }
+
+    // The command is planned once, and only run again at each interval
+    strvec_t command;
+    strvec_view(tokens, &command, start, tokens->length);
+    pipeline_t p;
+    if (plan_pipeline(&command, ctx->cmd_cache, ctx->arena, &p) != 0) {
+        return 1;
+    }
+    return watch_run(&p, ctx->exec_cache, interval, title);
+}
+
+static int builtin_onchange(builtin_ctx_t *ctx, strvec_t *tokens) {
+    int separator = strvec_find(tokens, "--");
+    if (separator < 2 || separator == tokens->length - 1) {
+        fprintf(stderr, "usage: onchange PATH... -- COMMAND\n");
+        return 1;
+    }
+    char **paths = arena_alloc(ctx->arena, (separator - 1) * sizeof(char *));
+    if (paths == NULL) {
+        fprintf(stderr, "onchange: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+    for (int i = 1; i < separator; i++) {
+        paths[i - 1] = strvec_get(tokens, i);
+    }
+
+    // The command is planned once, and only run again on each change
+    strvec_t command;
+    strvec_view(tokens, &command, separator + 1, tokens->length);
+    pipeline_t p;
+    if (plan_pipeline(&command, ctx->cmd_cache, ctx->arena, &p) != 0) {
+        return 1;
+    }
+    return onchange_run(&p, ctx->exec_cache, paths, separator - 1);
+}
+
+/*
+ * Run a pipeline reading from the contents of a ring buffer, which a child
+ * writes to its input so a full pipe cannot block the shell
+ * Returns 0 on success, 1 on error
+ */
+static int feed_pipeline(const lastout_t *lo, pipeline_t *p, exec_cache_t *exec_cache) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("lastout: pipe");
+        return 1;
+    }
+    pid_t writer = fork();
+    if (writer == -1) {
+        perror("lastout: fork");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    } else if (writer == 0) {
+        close(fds[0]);
+        _exit(lastout_write(lo, fds[1]));
+    }
+    close(fds[1]);
+
+    p->in_fd = fds[0];
+    int ret = start_pipeline(p, exec_cache, 0);
+    close(fds[0]);
+    if (ret == 0) {
+        ret = wait_pipeline(p);
+    }
+    waitpid(writer, NULL, 0);
+    return ret;
+}
+
+static int builtin_lastout(builtin_ctx_t *ctx, strvec_t *tokens) {
+    int bar = strvec_find(tokens, "|");
+    if ((bar == -1 && tokens->length > 1) || (bar != -1 && (bar != 1 || bar == tokens->length - 1))) {
+        fprintf(stderr, "usage: lastout [| COMMAND]\n");
+        return 1;
+    }
+    lastout_t *lo = ctx->lastout;
+    if (!lastout_enabled(lo)) {
+        fprintf(stderr, "lastout: output is not kept, set $%s to keep it\n", LASTOUT_VAR);
+        return 1;
+    }
+    if (lo->dropped > 0) {
+        fprintf(stderr, "lastout: the first %zu bytes of the output were not kept\n", lo->dropped);
+    }
+    if (bar == -1) {
+        fflush(stdout);
+        if (lastout_write(lo, STDOUT_FILENO) != 0) {
+            perror("lastout");
+            return 1;
+        }
+        return 0;
+    }
+
+    // Running a pipeline on the output does not replace it
+    strvec_t command;
+    strvec_view(tokens, &command, bar + 1, tokens->length);
+    pipeline_t p;
+    if (plan_pipeline(&command, ctx->cmd_cache, ctx->arena, &p) != 0) {
+        return 1;
+    }
+    return feed_pipeline(lo, &p, ctx->exec_cache);
+}
+
+static void on_interrupt(int sig) {
+}
+
+/*
+ * Copy lines of the coprocess's output to stdout. Ctrl-C stops waiting for
+ * them rather than ending the shell.
+ */
+static int coproc_read(job_t *job, unsigned n_lines) {
+    struct sigaction action = { .sa_handler = on_interrupt };
+    struct sigaction saved;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &saved);
+    fflush(stdout);
+    int ret = jobs_coproc_read(job, n_lines, STDOUT_FILENO);
+    int read_errno = errno;
+    sigaction(SIGINT, &saved, NULL);
+    if (ret != 0 && read_errno == EINTR) {
+        printf("\n");
+    } else if (ret != 0) {
+        fprintf(stderr, "coproc: output ended\n");
+    }
+    return ret;
+}
+
+static int builtin_coproc(builtin_ctx_t *ctx, strvec_t *tokens) {
+    const char *option = strvec_get(tokens, 1);
+    if (option == NULL) {
+        fprintf(stderr, "usage: coproc COMMAND | coproc -w [WORD...] | coproc -r [LINES] | coproc -c\n");
+        return 1;
+    }
+    if (option[0] != '-') {
+        strvec_t command;
+        strvec_view(tokens, &command, 1, tokens->length);
+        return jobs_start(ctx->jobs, &command, ctx->cmd_cache, ctx->exec_cache, ctx->arena, 1);
+    }
+
+    job_t *job = jobs_coproc(ctx->jobs);
+    if (job == NULL) {
+        fprintf(stderr, "coproc: no coprocess is running\n");
+        return 1;
+    }
+    if (strcmp(option, "-w") == 0) {
+        // The words are written as one line, in a single write
+        size_t len = 1;
+        for (unsigned i = 2; i < tokens->length; i++) {
+            len += strlen(strvec_get(tokens, i)) + 1;
+        }
+        char *line = arena_alloc(ctx->arena, len);
+        if (line == NULL) {
+            fprintf(stderr, "coproc: %s\n", strerror(ENOMEM));
+            return 1;
+        }
+        line[0] = '\0';
+        for (unsigned i = 2; i < tokens->length; i++) {
+            if (i > 2) {
+                strcat(line, " ");
+            }
+            strcat(line, strvec_get(tokens, i));
+        }
+        strcat(line, "\n");
+        if (jobs_coproc_write(job, line, strlen(line)) != 0) {
+            fprintf(stderr, "coproc: %s\n", strerror(errno));
+            return 1;
+        }
+        return 0;
+    } else if (strcmp(option, "-r") == 0) {
+        const char *value = strvec_get(tokens, 2);
+        char *end = NULL;
+        long n_lines = value != NULL ? strtol(value, &end, 10) : 1;
+        if (tokens->length > 3 || (value != NULL && (end == value || *end != '\0' || n_lines < 1))) {
+            fprintf(stderr, "coproc: invalid number of lines\n");
+            return 1;
+        }
+        return coproc_read(job, n_lines);
+    } else if (strcmp(option, "-c") == 0 && tokens->length == 2) {
+        jobs_coproc_close(job);
+        return 0;
+    }
+    fprintf(stderr, "usage: coproc COMMAND | coproc -w [WORD...] | coproc -r [LINES] | coproc -c\n");
+    return 1;
+}
+
+static const struct {
+    const char *name;
+    builtin_fn fn;
+    int takes_pipeline;
+} builtins[] = {
+    {"cd", builtin_cd, 0},
+    {"pushd", builtin_pushd, 0},
+    {"popd", builtin_popd, 0},
+    {"dirs", builtin_dirs, 0},
+    {"z", builtin_z, 0},
+    {"watch", builtin_watch, 1},
+    {"onchange", builtin_onchange, 1},
+    {"lastout", builtin_lastout, 1},
+    {"coproc", builtin_coproc, 1},
+};
+
+int run_builtin(builtin_ctx_t *ctx, strvec_t *tokens) {
+    const char *name = strvec_get(tokens, 0);
+    if (name == NULL) {
+        return NOT_BUILTIN;
+    }
+    for (int i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            if (!builtins[i].takes_pipeline && strvec_find(tokens, "|") != -1) {
+                return NOT_BUILTIN;
+            }
+            return builtins[i].fn(ctx, tokens);
+        }
+    }
+    return NOT_BUILTIN;
+}
+
+int builtin_complete(const char *prefix, strvec_t *matches) {
+    size_t len = strlen(prefix);
+    for (int i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strncmp(builtins[i].name, prefix, len) == 0 && strvec_add(matches, builtins[i].name) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
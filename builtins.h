@@ -0,0 +1,44 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "string_vector.h"
+#include "arena.h"
+#include "cmd_cache.h"
+#include "dirs.h"
+#include "exec_cache.h"
+#include "jobs.h"
+#include "lastout.h"
+
+// Returned by run_builtin when a command is not a builtin
+#define NOT_BUILTIN -1
+
+// Shell state that builtins act on
+typedef struct {
+    dirs_t *dirs;
+    cmd_cache_t *cmd_cache;
+    exec_cache_t *exec_cache;
+    arena_t *arena;          // Arena of the command line being run
+    lastout_t *lastout;      // End of the last pipeline's output
+    jobs_t *jobs;
+} builtin_ctx_t;
+
+/*
+ * Run a command if it is a builtin, i.e. one that changes the state of the
+ * shell itself and so cannot run in a child process. A command containing
+ * "|" is only a builtin if the builtin takes a pipeline, as watch does.
+ * ctx: State of the shell
+ * tokens: Vector containing tokens input by user into shell
+ * Returns NOT_BUILTIN if the command is not a builtin, otherwise 0 on success
+ * or 1 on error
+ */
+int run_builtin(builtin_ctx_t *ctx, strvec_t *tokens);
+
+/*
+ * Find all builtins whose names start with 'prefix'
+ * prefix: Prefix to complete
+ * matches: Vector to which the matching names are added, in no particular order
+ * Returns 0 on success, 1 on error
+ */
+int builtin_complete(const char *prefix, strvec_t *matches);
+
+#endif // BUILTINS_H
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bulk_output.h"
+#include "io_util.h"
+
+#define PIPE_SIZE (1 << 20)
+#define CHUNK_SIZE (1 << 20)
+// Pages are dropped from the cache a window at a time, once written back
+#define WINDOW_SIZE (8 << 20)
+#define FALLBACK_BUFFER_SIZE 65536
+
+int bulk_output_enabled(off_t *size_hint) {
+    const char *value = getenv(BULK_OUTPUT_VAR);
+    if (value == NULL) {
+        return 0;
+    }
+    *size_hint = parse_size(value);
+    return 1;
+}
+
+/*
+ * Write a range of a file back to disk and drop it from the page cache, which
+ * only drops pages that are clean
+ */
+static void drop_range(int fd, off_t start, off_t len) {
+    sync_file_range(fd, start, len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, start, len, POSIX_FADV_DONTNEED);
+}
+
+int bulk_output_copy(int in_fd, const redir_file_t *file, off_t size_hint) {
+    // splice does not write to files opened for appending, so appending is
+    // done by writing at the end explicitly
+    int out = redir_open(file->path, (file->flags & ~O_APPEND) | O_CLOEXEC);
+    struct stat st;
+    if (out == -1 || fstat(out, &st) == -1) {
+        fprintf(stderr, "%s: %s\n", file->path, strerror(errno));
+        if (out != -1) {
+            close(out);
+        }
+        return 1;
+    }
+    int regular = S_ISREG(st.st_mode);
+    off_t start = regular && (file->flags & O_APPEND) ? st.st_size : 0;
+
+    // These are only hints, so they may fail, e.g. on a file system without
+    // preallocation
+    fcntl(in_fd, F_SETPIPE_SZ, PIPE_SIZE);
+    if (regular) {
+        if (size_hint > 0) {
+            fallocate(out, FALLOC_FL_KEEP_SIZE, start, size_hint);
+        }
+        posix_fadvise(out, start, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    // Bytes before 'dropped' are out of the cache, and writeback was started
+    // for those before 'started'
+    off_t offset = start;
+    off_t started = start;
+    off_t dropped = start;
+    int use_splice = 1;
+    int ret = 0;
+    char *buf = NULL;
+    while (1) {
+        ssize_t n;
+        if (use_splice) {
+            loff_t off = offset;
+            n = splice(in_fd, NULL, out, regular ? &off : NULL, CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n == -1 && errno == EINVAL && offset == start) {
+                // The file cannot be spliced to
+                use_splice = 0;
+                continue;
+            }
+        } else {
+            if (buf == NULL && (buf = malloc(FALLBACK_BUFFER_SIZE)) == NULL) {
+                perror("malloc");
+                ret = 1;
+                break;
+            }
+            n = read(in_fd, buf, FALLBACK_BUFFER_SIZE);
+            if (n > 0 && write_all(out, buf, n, regular ? offset : -1) != 0) {
+                n = -1;
+            }
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            fprintf(stderr, "%s: %s\n", file->path, strerror(errno));
+            ret = 1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        offset += n;
+
+        if (regular && offset - started >= WINDOW_SIZE) {
+            // Start writing this window back, and drop the previous one,
+            // which has had the time of a window to be written
+            sync_file_range(out, started, offset - started, SYNC_FILE_RANGE_WRITE);
+            if (started > dropped) {
+                drop_range(out, dropped, started - dropped);
+                dropped = started;
+            }
+            started = offset;
+        }
+    }
+    free(buf);
+
+    if (regular) {
+        drop_range(out, dropped, offset - dropped);
+        // Give back the space preallocated past the end of the output, which
+        // truncating to the current size does
+        if (size_hint > 0 && start + size_hint > offset && fstat(out, &st) == 0 && st.st_size == offset) {
+            ftruncate(out, offset);
+        }
+    }
+    if (close(out) == -1) {
+        fprintf(stderr, "%s: %s\n", file->path, strerror(errno));
+        ret = 1;
+    }
+    return ret;
+}
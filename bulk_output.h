@@ -0,0 +1,33 @@
+#ifndef BULK_OUTPUT_H
+#define BULK_OUTPUT_H
+
+#include <sys/types.h>
+
+#include "redirect.h"
+
+// Setting this variable makes the shell write the output of pipelines
+// redirected to a file itself. Its value may give the expected size of the
+// output, e.g. "100G", which is preallocated.
+#define BULK_OUTPUT_VAR "SHELL_BULK_OUTPUT"
+
+/*
+ * Check whether bulk output is enabled
+ * size_hint: Receives the expected size of the output, or 0 if none is given
+ * Returns 1 if it is enabled, 0 otherwise
+ */
+int bulk_output_enabled(off_t *size_hint);
+
+/*
+ * Copy everything read from a pipe to a file, as a pipeline's output. The
+ * data is moved with splice rather than through a buffer, and on a regular
+ * file the space for 'size_hint' bytes is reserved up front and the pages
+ * written are dropped from the page cache as they reach the disk, so a huge
+ * output does not evict everything else from memory.
+ * in_fd: Read end of the pipe
+ * file: File to write, with the flags of its redirection
+ * size_hint: Number of bytes to preallocate, or 0
+ * Returns 0 on success, 1 on error
+ */
+int bulk_output_copy(int in_fd, const redir_file_t *file, off_t size_hint);
+
+#endif // BULK_OUTPUT_H
@@ -0,0 +1,398 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cmd_cache.h"
+
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+#define INITIAL_CHILDREN 2
+
+struct trie_node {
+    char *label;                  // Characters on the edge leading to this node
+    size_t label_len;
+    int dir;                      // First $PATH directory with the name ending here, or -1
+    struct trie_node **children;  // Sorted by the first character of their labels
+    unsigned n_children;
+    unsigned capacity;
+};
+
+static struct trie_node *node_new(const char *label, size_t len) {
+    struct trie_node *node = calloc(1, sizeof(struct trie_node));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->label = malloc(len + 1);
+    if (node->label == NULL) {
+        free(node);
+        return NULL;
+    }
+    memcpy(node->label, label, len);
+    node->label[len] = '\0';
+    node->label_len = len;
+    node->dir = -1;
+    return node;
+}
+
+static void node_free(struct trie_node *node) {
+    if (node == NULL) {
+        return;
+    }
+    for (unsigned i = 0; i < node->n_children; i++) {
+        node_free(node->children[i]);
+    }
+    free(node->children);
+    free(node->label);
+    free(node);
+}
+
+/*
+ * Binary search for the child whose label starts with 'c'
+ * Returns the position of that child, or the position at which it would be
+ * inserted if there is none
+ */
+static unsigned child_pos(const struct trie_node *node, unsigned char c) {
+    unsigned lo = 0;
+    unsigned hi = node->n_children;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if ((unsigned char) node->children[mid]->label[0] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static struct trie_node *find_child(const struct trie_node *node, unsigned char c) {
+    unsigned i = child_pos(node, c);
+    if (i < node->n_children && (unsigned char) node->children[i]->label[0] == c) {
+        return node->children[i];
+    }
+    return NULL;
+}
+
+static int add_child(struct trie_node *node, struct trie_node *child) {
+    if (node->n_children == node->capacity) {
+        unsigned new_capacity = node->capacity == 0 ? INITIAL_CHILDREN : 2 * node->capacity;
+        struct trie_node **new_children = realloc(node->children, new_capacity * sizeof(struct trie_node *));
+        if (new_children == NULL) {
+            return 1;
+        }
+        node->children = new_children;
+        node->capacity = new_capacity;
+    }
+    unsigned i = child_pos(node, child->label[0]);
+    memmove(node->children + i + 1, node->children + i, (node->n_children - i) * sizeof(struct trie_node *));
+    node->children[i] = child;
+    node->n_children++;
+    return 0;
+}
+
+static int trie_insert(struct trie_node *node, const char *name, int dir) {
+    while (*name != '\0') {
+        struct trie_node *child = find_child(node, *name);
+        if (child == NULL) {
+            struct trie_node *leaf = node_new(name, strlen(name));
+            if (leaf == NULL || add_child(node, leaf) != 0) {
+                node_free(leaf);
+                return 1;
+            }
+            node = leaf;
+            break;
+        }
+
+        size_t common = 0;
+        while (common < child->label_len && name[common] == child->label[common]) {
+            common++;
+        }
+        if (common < child->label_len) {
+            // Split the edge, with a new node holding the shared part
+            unsigned slot = child_pos(node, child->label[0]);
+            struct trie_node *mid = node_new(child->label, common);
+            if (mid == NULL) {
+                return 1;
+            }
+            memmove(child->label, child->label + common, child->label_len - common + 1);
+            child->label_len -= common;
+            if (add_child(mid, child) != 0) {
+                node_free(mid);
+                return 1;
+            }
+            node->children[slot] = mid;
+            child = mid;
+        }
+        node = child;
+        name += common;
+    }
+
+    if (node->dir == -1 || dir < node->dir) {
+        node->dir = dir;
+    }
+    return 0;
+}
+
+/*
+ * Find the node for the shortest name in the trie starting with 'prefix'
+ * name: Buffer of at least NAME_MAX + 1 bytes that receives that name
+ * Returns the node, or NULL if no name starts with 'prefix'
+ */
+static struct trie_node *trie_find(struct trie_node *node, const char *prefix, char *name) {
+    size_t len = 0;
+    name[0] = '\0';
+    while (*prefix != '\0') {
+        struct trie_node *child = find_child(node, *prefix);
+        if (child == NULL || len + child->label_len > NAME_MAX) {
+            return NULL;
+        }
+        size_t n = 0;
+        while (n < child->label_len && prefix[n] != '\0') {
+            if (prefix[n] != child->label[n]) {
+                return NULL;
+            }
+            n++;
+        }
+        memcpy(name + len, child->label, child->label_len + 1);
+        len += child->label_len;
+        prefix += n;
+        node = child;
+    }
+    return node;
+}
+
+/*
+ * Add every name at or below a node to a vector. Children are visited in
+ * order of their labels, so names come out sorted.
+ */
+static int trie_collect(const struct trie_node *node, char *name, size_t len, strvec_t *out) {
+    if (node->dir != -1 && strvec_add(out, name) != 0) {
+        return 1;
+    }
+    for (unsigned i = 0; i < node->n_children; i++) {
+        const struct trie_node *child = node->children[i];
+        if (len + child->label_len > NAME_MAX) {
+            continue;
+        }
+        memcpy(name + len, child->label, child->label_len + 1);
+        if (trie_collect(child, name, len + child->label_len, out) != 0) {
+            return 1;
+        }
+    }
+    name[len] = '\0';
+    return 0;
+}
+
+static void free_dirs(cmd_cache_t *cache) {
+    for (unsigned i = 0; i < cache->n_dirs; i++) {
+        free(cache->dirs[i].path);
+        strvec_clear(&cache->dirs[i].names);
+    }
+    free(cache->dirs);
+    cache->dirs = NULL;
+    cache->n_dirs = 0;
+}
+
+/*
+ * Replace the cached directories with those listed in 'path'
+ * Returns 0 on success, 1 on error
+ */
+static int set_dirs(cmd_cache_t *cache, const char *path) {
+    free_dirs(cache);
+    free(cache->path_value);
+    cache->path_value = NULL;
+
+    unsigned n = 1;
+    for (const char *p = path; *p != '\0'; p++) {
+        if (*p == ':') {
+            n++;
+        }
+    }
+    cache->dirs = calloc(n, sizeof(path_dir_t));
+    cache->path_value = strdup(path);
+    if (cache->dirs == NULL || cache->path_value == NULL) {
+        return 1;
+    }
+
+    const char *start = path;
+    while (1) {
+        const char *end = strchr(start, ':');
+        size_t len = end == NULL ? strlen(start) : (size_t) (end - start);
+        path_dir_t *dir = &cache->dirs[cache->n_dirs];
+        // An empty entry means the current directory
+        dir->path = len == 0 ? strdup(".") : strndup(start, len);
+        if (dir->path == NULL || strvec_init(&dir->names) != 0) {
+            free(dir->path);
+            return 1;
+        }
+        cache->n_dirs++;
+        if (end == NULL) {
+            break;
+        }
+        start = end + 1;
+    }
+    return 0;
+}
+
+/*
+ * List the executable regular files in a directory
+ * Returns 0 on success, 1 on error
+ */
+static int scan_dir(path_dir_t *dir) {
+    strvec_clear(&dir->names);
+    if (strvec_init(&dir->names) != 0) {
+        return 1;
+    }
+    DIR *d = opendir(dir->path);
+    if (d == NULL) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(d), entry->d_name, &st, 0) == -1) {
+            continue;
+        }
+        if (S_ISREG(st.st_mode) && (st.st_mode & 0111) != 0) {
+            if (strvec_add(&dir->names, entry->d_name) != 0) {
+                closedir(d);
+                return 1;
+            }
+        }
+    }
+    closedir(d);
+    // The names are kept until the directory changes
+    strvec_shrink_to_fit(&dir->names);
+    return 0;
+}
+
+static const char *path_value(void) {
+    const char *path = getenv("PATH");
+    return path != NULL ? path : DEFAULT_PATH;
+}
+
+/*
+ * Add the resolution of a command found in directory 'dir' to the shared cache
+ */
+static void share_resolution(cmd_cache_t *cache, const char *name, unsigned dir) {
+    const char *dirs[dir + 1];
+    struct timespec mtimes[dir + 1];
+    for (unsigned i = 0; i <= dir; i++) {
+        dirs[i] = cache->dirs[i].path;
+        mtimes[i] = cache->dirs[i].mtime;
+        if (!cache->dirs[i].scanned) {
+            mtimes[i].tv_sec = -1;
+            mtimes[i].tv_nsec = 0;
+        }
+    }
+    shared_cache_store(cache->shared, cache->path_value, name, dirs, mtimes, dir + 1);
+}
+
+int cmd_cache_init(cmd_cache_t *cache) {
+    memset(cache, 0, sizeof(cmd_cache_t));
+    return 0;
+}
+
+void cmd_cache_set_shared(cmd_cache_t *cache, shared_cache_t *shared) {
+    cache->shared = shared;
+}
+
+void cmd_cache_free(cmd_cache_t *cache) {
+    free_dirs(cache);
+    free(cache->path_value);
+    node_free(cache->root);
+    memset(cache, 0, sizeof(cmd_cache_t));
+}
+
+int cmd_cache_refresh(cmd_cache_t *cache) {
+    const char *path = path_value();
+    int changed = cache->root == NULL;
+    if (cache->path_value == NULL || strcmp(cache->path_value, path) != 0) {
+        if (set_dirs(cache, path) != 0) {
+            return 1;
+        }
+        changed = 1;
+    }
+
+    for (unsigned i = 0; i < cache->n_dirs; i++) {
+        path_dir_t *dir = &cache->dirs[i];
+        struct stat st;
+        if (stat(dir->path, &st) == -1) {
+            if (dir->scanned) {
+                strvec_take(&dir->names, 0);
+                dir->scanned = 0;
+                changed = 1;
+            }
+            continue;
+        }
+        if (!dir->scanned || st.st_mtim.tv_sec != dir->mtime.tv_sec ||
+            st.st_mtim.tv_nsec != dir->mtime.tv_nsec) {
+            if (scan_dir(dir) != 0) {
+                return 1;
+            }
+            dir->mtime = st.st_mtim;
+            dir->scanned = 1;
+            changed = 1;
+        }
+    }
+    if (!changed) {
+        return 0;
+    }
+
+    // Rebuilding from the names already in memory is cheap next to reading
+    // the directories again
+    node_free(cache->root);
+    if ((cache->root = node_new("", 0)) == NULL) {
+        return 1;
+    }
+    for (unsigned i = 0; i < cache->n_dirs; i++) {
+        for (unsigned j = 0; j < cache->dirs[i].names.length; j++) {
+            if (trie_insert(cache->root, strvec_get(&cache->dirs[i].names, j), i) != 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int cmd_cache_complete(cmd_cache_t *cache, const char *prefix, strvec_t *matches) {
+    if (cmd_cache_refresh(cache) != 0) {
+        return 1;
+    }
+    char name[NAME_MAX + 1];
+    struct trie_node *node = trie_find(cache->root, prefix, name);
+    if (node == NULL) {
+        return 0;
+    }
+    return trie_collect(node, name, strlen(name), matches);
+}
+
+int cmd_cache_resolve(cmd_cache_t *cache, const char *name, char *buf, size_t size) {
+    if (strchr(name, '/') != NULL) {
+        return 1;
+    }
+    if (cache->shared != NULL && shared_cache_lookup(cache->shared, path_value(), name, buf, size) == 0) {
+        return 0;
+    }
+    if (cmd_cache_refresh(cache) != 0) {
+        return 1;
+    }
+    char found[NAME_MAX + 1];
+    struct trie_node *node = trie_find(cache->root, name, found);
+    if (node == NULL || node->dir == -1 || strcmp(found, name) != 0) {
+        return 1;
+    }
+    if (snprintf(buf, size, "%s/%s", cache->dirs[node->dir].path, name) >= size) {
+        return 1;
+    }
+    if (cache->shared != NULL) {
+        share_resolution(cache, name, node->dir);
+    }
+    return 0;
+}
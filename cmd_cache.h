@@ -0,0 +1,86 @@
+#ifndef CMD_CACHE_H
+#define CMD_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "string_vector.h"
+#include "shared_cache.h"
+
+struct trie_node;
+
+// Executables found in one directory of $PATH
+typedef struct {
+    char *path;
+    struct timespec mtime;  // Modification time of the directory when it was scanned
+    int scanned;
+    strvec_t names;
+} path_dir_t;
+
+/*
+ * Cache of the executables on $PATH. The names are kept in a compressed trie
+ * (each edge is labelled with a string rather than a single character) that
+ * records, for each name, the first directory of $PATH containing it. The
+ * same trie answers prefix queries for completion and exact queries for
+ * command resolution. Directories are only rescanned when their modification
+ * time changes.
+ */
+typedef struct {
+    char *path_value;       // Value of $PATH the directories were taken from
+    path_dir_t *dirs;
+    unsigned n_dirs;
+    struct trie_node *root;
+    shared_cache_t *shared; // Resolutions shared with other shells, or NULL
+} cmd_cache_t;
+
+/*
+ * Initializes a new, empty command cache. No directories are scanned until
+ * the cache is first used.
+ * cache: Pointer to the cache to initialize
+ * Returns 0 on success, 1 on error
+ */
+int cmd_cache_init(cmd_cache_t *cache);
+
+/*
+ * Share command resolutions with other shells. Resolutions found in the
+ * shared cache save scanning $PATH, and resolutions made by scanning are
+ * added to it.
+ * cache: Pointer to the cache
+ * shared: Pointer to the shared cache, which must outlive 'cache'
+ */
+void cmd_cache_set_shared(cmd_cache_t *cache, shared_cache_t *shared);
+
+/*
+ * Releases all memory held by a command cache
+ * cache: Pointer to the cache to free
+ */
+void cmd_cache_free(cmd_cache_t *cache);
+
+/*
+ * Bring a cache up to date with $PATH, rescanning only the directories that
+ * were modified since they were last scanned
+ * cache: Pointer to the cache
+ * Returns 0 on success, 1 on error
+ */
+int cmd_cache_refresh(cmd_cache_t *cache);
+
+/*
+ * Find all executables on $PATH whose names start with 'prefix'
+ * cache: Pointer to the cache
+ * prefix: Prefix to complete
+ * matches: Vector to which the matching names are added, in sorted order
+ * Returns 0 on success, 1 on error
+ */
+int cmd_cache_complete(cmd_cache_t *cache, const char *prefix, strvec_t *matches);
+
+/*
+ * Find the full path of the executable that running 'name' would launch
+ * cache: Pointer to the cache
+ * name: Name of the command
+ * buf: Buffer in which to store the full path
+ * size: Size of 'buf'
+ * Returns 0 if the command was found, 1 otherwise
+ */
+int cmd_cache_resolve(cmd_cache_t *cache, const char *name, char *buf, size_t size);
+
+#endif // CMD_CACHE_H
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dirs.h"
+
+#define INITIAL_SIZE 4
+
+static void release(dir_ref_t *dir) {
+    if (dir->fd != -1) {
+        close(dir->fd);
+    }
+    free(dir->path);
+    dir->fd = -1;
+    dir->path = NULL;
+}
+
+/*
+ * Open a directory relative to the working directory of the shell
+ * Returns 0 on success, 1 on error
+ */
+static int open_dir(const dirs_t *dirs, const char *path, dir_ref_t *dir) {
+    dir->fd = dirs_open(dirs, path, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+    dir->path = NULL;
+    return dir->fd == -1;
+}
+
+/*
+ * Make an open directory the working directory. The old working directory
+ * is pushed on the stack if 'push' is set and becomes the previous directory
+ * otherwise. On success, the state takes ownership of 'dir'.
+ * Returns 0 on success, 1 on error
+ */
+static int enter(dirs_t *dirs, dir_ref_t *dir, int push) {
+    if (push && dirs->depth == dirs->capacity) {
+        unsigned new_capacity = dirs->capacity == 0 ? INITIAL_SIZE : dirs->capacity * 2;
+        dir_ref_t *new_stack = realloc(dirs->stack, new_capacity * sizeof(dir_ref_t));
+        if (new_stack == NULL) {
+            return 1;
+        }
+        dirs->stack = new_stack;
+        dirs->capacity = new_capacity;
+    }
+    if (fchdir(dir->fd) == -1) {
+        return 1;
+    }
+
+    // The path a directory was opened with may be relative or contain
+    // symbolic links, so the canonical path is recorded instead
+    free(dir->path);
+    dir->path = getcwd(NULL, 0);
+
+    if (push) {
+        dirs->stack[dirs->depth++] = dirs->cwd;
+    } else {
+        release(&dirs->previous);
+        dirs->previous = dirs->cwd;
+    }
+    dirs->cwd = *dir;
+
+    if (dirs->previous.path != NULL) {
+        setenv("OLDPWD", dirs->previous.path, 1);
+    }
+    if (dirs->cwd.path != NULL) {
+        setenv("PWD", dirs->cwd.path, 1);
+        if (dirs->have_frecency) {
+            frecency_visit(&dirs->frecency, dirs->cwd.path);
+        }
+    }
+    return 0;
+}
+
+int dirs_init(dirs_t *dirs, const char *frecency_path) {
+    memset(dirs, 0, sizeof(dirs_t));
+    dirs->previous.fd = -1;
+    dirs->cwd.fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dirs->cwd.fd == -1) {
+        return 1;
+    }
+    dirs->cwd.path = getcwd(NULL, 0);
+    if (frecency_path != NULL && frecency_open(&dirs->frecency, frecency_path) == 0) {
+        dirs->have_frecency = 1;
+    }
+    return 0;
+}
+
+void dirs_free(dirs_t *dirs) {
+    release(&dirs->cwd);
+    release(&dirs->previous);
+    for (unsigned i = 0; i < dirs->depth; i++) {
+        release(&dirs->stack[i]);
+    }
+    free(dirs->stack);
+    if (dirs->have_frecency) {
+        frecency_close(&dirs->frecency);
+    }
+    memset(dirs, 0, sizeof(dirs_t));
+}
+
+int dirs_open(const dirs_t *dirs, const char *path, int flags, int mode) {
+    return openat(dirs->cwd.fd != -1 ? dirs->cwd.fd : AT_FDCWD, path, flags, mode);
+}
+
+int dirs_cd(dirs_t *dirs, const char *target) {
+    dir_ref_t dir;
+    if (strcmp(target, "-") == 0) {
+        if (dirs->previous.fd == -1) {
+            errno = ENOENT;
+            return 1;
+        }
+        // Swap the two descriptors rather than opening the directory again
+        dir = dirs->previous;
+        dirs->previous.fd = -1;
+        dirs->previous.path = NULL;
+        if (enter(dirs, &dir, 0) != 0) {
+            dirs->previous = dir;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (open_dir(dirs, target, &dir) != 0) {
+        return 1;
+    }
+    if (enter(dirs, &dir, 0) != 0) {
+        int saved_errno = errno;
+        release(&dir);
+        errno = saved_errno;
+        return 1;
+    }
+    return 0;
+}
+
+int dirs_push(dirs_t *dirs, const char *target) {
+    dir_ref_t dir;
+    if (target == NULL) {
+        if (dirs->depth == 0) {
+            errno = ENOENT;
+            return 1;
+        }
+        dir = dirs->stack[--dirs->depth];
+        if (enter(dirs, &dir, 1) != 0) {
+            dirs->stack[dirs->depth++] = dir;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (open_dir(dirs, target, &dir) != 0) {
+        return 1;
+    }
+    if (enter(dirs, &dir, 1) != 0) {
+        int saved_errno = errno;
+        release(&dir);
+        errno = saved_errno;
+        return 1;
+    }
+    return 0;
+}
+
+int dirs_pop(dirs_t *dirs) {
+    if (dirs->depth == 0) {
+        errno = ENOENT;
+        return 1;
+    }
+    dir_ref_t dir = dirs->stack[dirs->depth - 1];
+    if (enter(dirs, &dir, 0) != 0) {
+        return 1;
+    }
+    dirs->depth--;
+    return 0;
+}
+
+int dirs_jump(dirs_t *dirs, const char *fragment) {
+    const char *path = dirs->have_frecency ? frecency_find(&dirs->frecency, fragment) : NULL;
+    if (path == NULL) {
+        errno = ENOENT;
+        return 1;
+    }
+    // The path points into the database, which changing directory updates
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return 1;
+    }
+    int ret = dirs_cd(dirs, copy);
+    free(copy);
+    return ret;
+}
+
+void dirs_print(const dirs_t *dirs) {
+    printf("%s", dirs->cwd.path != NULL ? dirs->cwd.path : ".");
+    for (unsigned i = dirs->depth; i > 0; i--) {
+        printf(" %s", dirs->stack[i - 1].path != NULL ? dirs->stack[i - 1].path : ".");
+    }
+    printf("\n");
+}
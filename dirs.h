@@ -0,0 +1,92 @@
+#ifndef DIRS_H
+#define DIRS_H
+
+#include "frecency.h"
+
+// A directory the shell refers to by descriptor
+typedef struct {
+    int fd;         // O_PATH descriptor of the directory, or -1
+    char *path;     // Absolute path of the directory
+} dir_ref_t;
+
+/*
+ * The working directory of the shell, the previous working directory and the
+ * pushd stack. Each is held open with an O_PATH descriptor, so returning to
+ * one of them does not resolve its path again, and files can be opened
+ * relative to the working directory with openat. Every directory changed to
+ * is recorded in a frecency database for jumping back to it with 'z'.
+ */
+typedef struct {
+    dir_ref_t cwd;
+    dir_ref_t previous;
+    dir_ref_t *stack;           // Top of the stack is the last element
+    unsigned depth;
+    unsigned capacity;
+    frecency_t frecency;
+    int have_frecency;
+} dirs_t;
+
+/*
+ * Initializes the directory state from the current working directory
+ * dirs: Pointer to the state to initialize
+ * frecency_path: Location of the frecency database, or NULL to not keep one
+ * Returns 0 on success, 1 on error
+ */
+int dirs_init(dirs_t *dirs, const char *frecency_path);
+
+/*
+ * Closes all directory descriptors and releases the memory of the state
+ * dirs: Pointer to the state to free
+ */
+void dirs_free(dirs_t *dirs);
+
+/*
+ * Open a file relative to the working directory of the shell
+ * dirs: Pointer to the directory state
+ * path: Path of the file
+ * flags, mode: As for open
+ * Returns the file descriptor on success, -1 on error
+ */
+int dirs_open(const dirs_t *dirs, const char *path, int flags, int mode);
+
+/*
+ * Change the working directory. A target of "-" is the previous directory.
+ * dirs: Pointer to the directory state
+ * target: Directory to change to
+ * Returns 0 on success, 1 on error with errno set
+ */
+int dirs_cd(dirs_t *dirs, const char *target);
+
+/*
+ * Push the working directory on the stack and change to another directory.
+ * Without a target, the working directory is swapped with the top of the
+ * stack.
+ * dirs: Pointer to the directory state
+ * target: Directory to change to, or NULL
+ * Returns 0 on success, 1 on error with errno set
+ */
+int dirs_push(dirs_t *dirs, const char *target);
+
+/*
+ * Change to the directory at the top of the stack and remove it from the stack
+ * dirs: Pointer to the directory state
+ * Returns 0 on success, 1 on error with errno set
+ */
+int dirs_pop(dirs_t *dirs);
+
+/*
+ * Change to the highest ranked directory in the frecency database matching
+ * a fragment
+ * dirs: Pointer to the directory state
+ * fragment: Fragment of the directory path
+ * Returns 0 on success, 1 on error with errno set
+ */
+int dirs_jump(dirs_t *dirs, const char *fragment);
+
+/*
+ * Print the working directory followed by the stack, from top to bottom
+ * dirs: Pointer to the directory state
+ */
+void dirs_print(const dirs_t *dirs);
+
+#endif // DIRS_H
@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exec_cache.h"
+
+static void drop(exec_cache_t *ec, unsigned i) {
+    close(ec->entries[i].fd);
+    free(ec->entries[i].path);
+    ec->entries[i] = ec->entries[--ec->n_entries];
+}
+
+void exec_cache_init(exec_cache_t *ec) {
+    memset(ec, 0, sizeof(exec_cache_t));
+}
+
+void exec_cache_free(exec_cache_t *ec) {
+    while (ec->n_entries > 0) {
+        drop(ec, ec->n_entries - 1);
+    }
+}
+
+int exec_cache_get(exec_cache_t *ec, const char *path) {
+    unsigned i = 0;
+    while (i < ec->n_entries && strcmp(ec->entries[i].path, path) != 0) {
+        i++;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        if (i < ec->n_entries) {
+            drop(ec, i);
+        }
+        return -1;
+    }
+    if (i < ec->n_entries) {
+        // The descriptor is only used while the path, following any
+        // symlinks as exec would, still names the file it refers to
+        exec_entry_t *e = &ec->entries[i];
+        struct stat fd_st;
+        if (fstat(e->fd, &fd_st) == 0 && fd_st.st_dev == st.st_dev && fd_st.st_ino == st.st_ino) {
+            e->last_used = ++ec->clock;
+            return e->fd;
+        }
+        drop(ec, i);
+    }
+
+    int fd = open(path, O_PATH | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    if (ec->n_entries == EXEC_CACHE_SIZE) {
+        unsigned lru = 0;
+        for (unsigned j = 1; j < ec->n_entries; j++) {
+            if (ec->entries[j].last_used < ec->entries[lru].last_used) {
+                lru = j;
+            }
+        }
+        drop(ec, lru);
+    }
+    exec_entry_t *e = &ec->entries[ec->n_entries++];
+    e->path = copy;
+    e->fd = fd;
+    e->last_used = ++ec->clock;
+    return fd;
+}
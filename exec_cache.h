@@ -0,0 +1,52 @@
+#ifndef EXEC_CACHE_H
+#define EXEC_CACHE_H
+
+#include <sys/types.h>
+
+#define EXEC_CACHE_SIZE 32
+
+// An open descriptor for a program
+typedef struct {
+    char *path;
+    int fd;                     // O_PATH descriptor of the program
+    unsigned long last_used;
+} exec_entry_t;
+
+/*
+ * Descriptors for the most recently run programs, so they can be executed
+ * with execveat without the kernel resolving their paths again. On every
+ * lookup, the inode of the descriptor is checked against the inode its path
+ * names now; when the program is replaced (e.g. by a package upgrade, or by
+ * switching the target of a symlink on $PATH), the new file is opened
+ * instead. The
+ * least recently used entry is dropped when the cache is full.
+ */
+typedef struct {
+    exec_entry_t entries[EXEC_CACHE_SIZE];
+    unsigned n_entries;
+    unsigned long clock;
+} exec_cache_t;
+
+/*
+ * Initializes a new, empty exec cache
+ * ec: Pointer to the cache to initialize
+ */
+void exec_cache_init(exec_cache_t *ec);
+
+/*
+ * Closes all descriptors of an exec cache and releases its memory
+ * ec: Pointer to the cache to free
+ */
+void exec_cache_free(exec_cache_t *ec);
+
+/*
+ * Get a descriptor for the program at a path, opening it if it is not cached
+ * or the path now names a different file. The descriptor is close-on-exec and
+ * stays owned by the cache.
+ * ec: Pointer to the cache
+ * path: Absolute path of the program
+ * Returns the descriptor, or -1 if the program cannot be opened
+ */
+int exec_cache_get(exec_cache_t *ec, const char *path);
+
+#endif // EXEC_CACHE_H
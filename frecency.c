@@ -0,0 +1,331 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frecency.h"
+
+#define FRECENCY_MAGIC "SHZDB1"
+
+// Once the ranks add up to more than this, they are all scaled down and
+// directories that have not been visited in a long time are forgotten
+#define MAX_TOTAL_RANK 9000.0f
+#define AGING_FACTOR 0.99f
+
+struct frecency_header {
+    char magic[8];
+    uint32_t count;
+    uint32_t strings_size;
+};
+
+// Entries refer to their path by offset into the string pool, and to the
+// last component of the path by offset into the same string
+struct frecency_entry {
+    uint32_t path;
+    uint32_t base;
+    float rank;
+    uint32_t last_visit;
+};
+
+static const char *entry_path(const frecency_t *db, const struct frecency_entry *e) {
+    return db->strings + e->path;
+}
+
+static const char *entry_base(const frecency_t *db, const struct frecency_entry *e) {
+    return db->strings + e->base;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash == NULL || slash[1] == '\0' ? path : slash + 1;
+}
+
+/*
+ * Order entries by the last component of their path, then by the full path
+ */
+static int compare_key(const char *base1, const char *path1, const char *base2, const char *path2) {
+    int cmp = strcmp(base1, base2);
+    return cmp != 0 ? cmp : strcmp(path1, path2);
+}
+
+/*
+ * Weigh the rank of an entry by how long ago it was last visited
+ */
+static float score(const struct frecency_entry *e, time_t now) {
+    time_t age = now - (time_t) e->last_visit;
+    if (age < 3600) {
+        return e->rank * 4;
+    } else if (age < 86400) {
+        return e->rank * 2;
+    } else if (age < 604800) {
+        return e->rank / 2;
+    }
+    return e->rank / 4;
+}
+
+static void unmap(frecency_t *db) {
+    if (db->map != NULL) {
+        munmap(db->map, db->map_size);
+    }
+    db->map = NULL;
+    db->map_size = 0;
+    db->count = 0;
+    db->entries = NULL;
+    db->strings = NULL;
+}
+
+/*
+ * Map the database file, replacing any current mapping. A missing or
+ * malformed file is treated as an empty database.
+ * Returns 0 on success, 1 on error
+ */
+static int load(frecency_t *db) {
+    unmap(db);
+    int fd = open(db->path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 1;
+    }
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+    if (st.st_size < sizeof(struct frecency_header)) {
+        close(fd);
+        return 0;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+    struct frecency_header *header = (struct frecency_header *) map;
+    size_t entries_size = (size_t) header->count * sizeof(struct frecency_entry);
+    if (memcmp(header->magic, FRECENCY_MAGIC, sizeof(FRECENCY_MAGIC)) != 0 ||
+        sizeof(struct frecency_header) + entries_size + header->strings_size != st.st_size) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    db->map = map;
+    db->map_size = st.st_size;
+    db->count = header->count;
+    db->entries = (struct frecency_entry *) (map + sizeof(struct frecency_header));
+    db->strings = map + sizeof(struct frecency_header) + entries_size;
+    return 0;
+}
+
+/*
+ * Reload the database if another shell replaced the file since it was mapped
+ * Returns 0 on success, 1 on error
+ */
+static int refresh(frecency_t *db) {
+    struct stat st;
+    if (stat(db->path, &st) == -1) {
+        return errno == ENOENT ? 0 : 1;
+    }
+    if (db->map != NULL && st.st_dev == db->dev && st.st_ino == db->ino) {
+        return 0;
+    }
+    return load(db);
+}
+
+/*
+ * Find the position of the entry with a given key, or where it would be
+ * inserted
+ * Returns the position
+ */
+static uint32_t lower_bound(const frecency_t *db, const char *base, const char *path) {
+    uint32_t lo = 0;
+    uint32_t hi = db->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const struct frecency_entry *e = &db->entries[mid];
+        if (compare_key(entry_base(db, e), entry_path(db, e), base, path) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Copy a path to the end of a string pool and point an entry at it
+ * Returns the new length of the pool
+ */
+static size_t add_path(struct frecency_entry *e, char *strings, size_t strings_len, const char *path) {
+    size_t len = strlen(path);
+    e->path = strings_len;
+    e->base = strings_len + (base_name(path) - path);
+    memcpy(strings + strings_len, path, len + 1);
+    return strings_len + len + 1;
+}
+
+/*
+ * Write the current entries plus a new one at position 'pos' to a new file
+ * and move it into place. Ranks are aged while copying.
+ * Returns 0 on success, 1 on error
+ */
+static int rewrite(frecency_t *db, uint32_t pos, const char *dir, time_t now) {
+    float total = 1.0f;
+    for (uint32_t i = 0; i < db->count; i++) {
+        total += db->entries[i].rank;
+    }
+    float factor = total > MAX_TOTAL_RANK ? AGING_FACTOR : 1.0f;
+
+    size_t strings_size = strlen(dir) + 1;
+    for (uint32_t i = 0; i < db->count; i++) {
+        strings_size += strlen(entry_path(db, &db->entries[i])) + 1;
+    }
+    size_t size = sizeof(struct frecency_header) + (db->count + 1) * sizeof(struct frecency_entry) + strings_size;
+    char *buf = calloc(1, size);
+    if (buf == NULL) {
+        return 1;
+    }
+    struct frecency_entry *entries = (struct frecency_entry *) (buf + sizeof(struct frecency_header));
+
+    // Entries are copied in order, so the array stays sorted. Dropped entries
+    // leave unused space at the end of the entry array, which is removed
+    // below by moving the strings down.
+    uint32_t count = 0;
+    size_t strings_len = 0;
+    char *strings = (char *) (entries + db->count + 1);
+    for (uint32_t i = 0; i <= db->count; i++) {
+        if (i == pos) {
+            struct frecency_entry e = {0, 0, 1.0f, (uint32_t) now};
+            entries[count++] = e;
+            strings_len = add_path(&entries[count - 1], strings, strings_len, dir);
+        }
+        if (i == db->count) {
+            break;
+        }
+        struct frecency_entry e = db->entries[i];
+        e.rank *= factor;
+        if (e.rank < 1.0f) {
+            continue;
+        }
+        entries[count++] = e;
+        strings_len = add_path(&entries[count - 1], strings, strings_len, entry_path(db, &db->entries[i]));
+    }
+    memmove(entries + count, strings, strings_len);
+    size = sizeof(struct frecency_header) + count * sizeof(struct frecency_entry) + strings_len;
+
+    struct frecency_header *header = (struct frecency_header *) buf;
+    memcpy(header->magic, FRECENCY_MAGIC, sizeof(FRECENCY_MAGIC));
+    header->count = count;
+    header->strings_size = strings_len;
+
+    char tmp_path[4096];
+    int ret = 1;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", db->path, getpid()) < sizeof(tmp_path)) {
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd != -1) {
+            ret = write(fd, buf, size) != size;
+            ret |= close(fd) != 0;
+            if (ret == 0) {
+                ret = rename(tmp_path, db->path) != 0;
+            }
+            if (ret != 0) {
+                unlink(tmp_path);
+            }
+        }
+    }
+    free(buf);
+    return ret != 0 || load(db) != 0;
+}
+
+int frecency_open(frecency_t *db, const char *path) {
+    memset(db, 0, sizeof(frecency_t));
+    db->path = strdup(path);
+    if (db->path == NULL) {
+        return 1;
+    }
+    if (load(db) != 0) {
+        free(db->path);
+        db->path = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void frecency_close(frecency_t *db) {
+    unmap(db);
+    free(db->path);
+    db->path = NULL;
+}
+
+int frecency_visit(frecency_t *db, const char *dir) {
+    if (refresh(db) != 0) {
+        return 1;
+    }
+    time_t now = time(NULL);
+    const char *base = base_name(dir);
+    uint32_t pos = lower_bound(db, base, dir);
+    if (pos < db->count && strcmp(entry_path(db, &db->entries[pos]), dir) == 0) {
+        // Known directories are updated in the shared mapping
+        db->entries[pos].rank += 1.0f;
+        db->entries[pos].last_visit = (uint32_t) now;
+        return 0;
+    }
+    return rewrite(db, pos, dir, now);
+}
+
+const char *frecency_find(frecency_t *db, const char *fragment) {
+    if (refresh(db) != 0 || fragment[0] == '\0') {
+        return NULL;
+    }
+    time_t now = time(NULL);
+    size_t len = strlen(fragment);
+    const struct frecency_entry *best = NULL;
+    float best_score = 0;
+
+    // Entries whose last component starts with the fragment are contiguous,
+    // starting where the fragment itself would be inserted
+    for (uint32_t i = lower_bound(db, fragment, ""); i < db->count; i++) {
+        const struct frecency_entry *e = &db->entries[i];
+        if (strncmp(entry_base(db, e), fragment, len) != 0) {
+            break;
+        }
+        float s = score(e, now);
+        if (best == NULL || s > best_score) {
+            best = e;
+            best_score = s;
+        }
+    }
+    if (best != NULL) {
+        return entry_path(db, best);
+    }
+
+    for (uint32_t i = 0; i < db->count; i++) {
+        const struct frecency_entry *e = &db->entries[i];
+        if (strstr(entry_path(db, e), fragment) == NULL) {
+            continue;
+        }
+        float s = score(e, now);
+        if (best == NULL || s > best_score) {
+            best = e;
+            best_score = s;
+        }
+    }
+    return best == NULL ? NULL : entry_path(db, best);
+}
+
+void frecency_print(frecency_t *db) {
+    if (refresh(db) != 0) {
+        return;
+    }
+    time_t now = time(NULL);
+    for (uint32_t i = 0; i < db->count; i++) {
+        const struct frecency_entry *e = &db->entries[i];
+        printf("%-10.2f %s\n", score(e, now), entry_path(db, e));
+    }
+}
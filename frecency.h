@@ -0,0 +1,68 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct frecency_entry;
+
+/*
+ * Database of visited directories ranked by frequency and recency of visits,
+ * for jumping to a directory by a fragment of its name. The database is a
+ * single compact file that is mapped into memory: a header, an array of
+ * fixed-size entries sorted by the last component of their paths, and a pool
+ * of path strings. Fragments that start the last component of a path are
+ * found by binary search, and visits to known directories update their entry
+ * in place. The file is only rewritten when a new directory is added.
+ */
+typedef struct {
+    char *path;                      // Location of the database file
+    char *map;
+    size_t map_size;
+    uint32_t count;
+    struct frecency_entry *entries;
+    const char *strings;
+    dev_t dev;                       // Identity of the mapped file, to notice
+    ino_t ino;                       // when another shell replaces it
+} frecency_t;
+
+/*
+ * Opens the database stored at 'path', which need not exist yet
+ * db: Pointer to the database to initialize
+ * path: Location of the database file
+ * Returns 0 on success, 1 on error
+ */
+int frecency_open(frecency_t *db, const char *path);
+
+/*
+ * Unmaps a database and releases its memory
+ * db: Pointer to the database to close
+ */
+void frecency_close(frecency_t *db);
+
+/*
+ * Record a visit to a directory
+ * db: Pointer to the database
+ * dir: Absolute path of the directory
+ * Returns 0 on success, 1 on error
+ */
+int frecency_visit(frecency_t *db, const char *dir);
+
+/*
+ * Find the highest ranked directory matching a fragment. Directories whose
+ * last component starts with the fragment are preferred; otherwise any
+ * directory containing the fragment in its path matches.
+ * db: Pointer to the database
+ * fragment: Fragment to look for
+ * Returns the path of the directory (not a copy), or NULL if none matches
+ */
+const char *frecency_find(frecency_t *db, const char *fragment);
+
+/*
+ * Print every directory in a database with its current score
+ * db: Pointer to the database
+ */
+void frecency_print(frecency_t *db);
+
+#endif // FRECENCY_H
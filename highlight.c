@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "highlight.h"
+#include "redirect.h"
+
+#define HL_CHECKPOINT_INTERVAL 64
+#define INITIAL_SIZE 128
+
+// Every sequence starts from the default rendition, so switching between
+// any two classes takes a single sequence
+static const char *sequences[] = {
+    [HL_DEFAULT] = "\x1b[0m",
+    [HL_COMMAND] = "\x1b[0;1;32m",
+    [HL_OPTION] = "\x1b[0;36m",
+    [HL_PIPE] = "\x1b[0;1;35m",
+    [HL_REDIRECT] = "\x1b[0;33m",
+    [HL_FILE] = "\x1b[0;4m",
+};
+
+static int reserve(void **data, size_t *cap, size_t needed, size_t elem_size) {
+    if (needed <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap == 0 ? INITIAL_SIZE : *cap;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    void *new_data = realloc(*data, new_cap * elem_size);
+    if (new_data == NULL) {
+        return 1;
+    }
+    *data = new_data;
+    *cap = new_cap;
+    return 0;
+}
+
+/*
+ * Classify the word in [start, end) and update the lexer state accordingly
+ */
+static void finish_word(highlighter_t *hl, struct hl_state *st, const char *line, size_t start, size_t end) {
+    size_t len = end - start;
+    const char *w = line + start;
+    unsigned char class;
+    size_t op_len;
+    int redir;
+
+    if (len == 1 && w[0] == '|') {
+        class = HL_PIPE;
+        st->expect = HL_COMMAND;
+        st->seen_command = 0;
+    } else if ((redir = redir_recognize(w, len, &op_len)) > 0) {
+        // A file attached to the operator, as in ">out", is part of the word
+        memset(hl->classes + start, HL_REDIRECT, op_len);
+        memset(hl->classes + start + op_len, HL_FILE, len - op_len);
+        if (redir == 1 && op_len == len) {
+            st->expect = HL_FILE;
+        } else {
+            st->expect = st->seen_command ? HL_DEFAULT : HL_COMMAND;
+        }
+        st->in_word = 0;
+        return;
+    } else if (st->expect == HL_COMMAND) {
+        class = HL_COMMAND;
+        st->seen_command = 1;
+        st->expect = HL_DEFAULT;
+    } else if (st->expect == HL_FILE) {
+        class = HL_FILE;
+        st->expect = st->seen_command ? HL_DEFAULT : HL_COMMAND;
+    } else {
+        class = w[0] == '-' ? HL_OPTION : HL_DEFAULT;
+    }
+
+    memset(hl->classes + start, class, len);
+    st->in_word = 0;
+}
+
+int hl_init(highlighter_t *hl) {
+    memset(hl, 0, sizeof(highlighter_t));
+    if (reserve((void **) &hl->checkpoints, &hl->checkpoints_cap, 1, sizeof(struct hl_state)) != 0) {
+        return 1;
+    }
+    memset(&hl->checkpoints[0], 0, sizeof(struct hl_state));
+    hl->checkpoints[0].expect = HL_COMMAND;
+    return 0;
+}
+
+void hl_free(highlighter_t *hl) {
+    free(hl->classes);
+    free(hl->checkpoints);
+    memset(hl, 0, sizeof(highlighter_t));
+}
+
+void hl_invalidate(highlighter_t *hl, size_t pos) {
+    if (pos < hl->valid) {
+        hl->valid = pos;
+    }
+}
+
+int hl_update(highlighter_t *hl, const char *line, size_t len, size_t upto) {
+    if (upto > len) {
+        upto = len;
+    }
+    if (hl->valid >= upto) {
+        return 0;
+    }
+    if (reserve((void **) &hl->classes, &hl->classes_cap, len, 1) != 0 ||
+        reserve((void **) &hl->checkpoints, &hl->checkpoints_cap,
+                len / HL_CHECKPOINT_INTERVAL + 1, sizeof(struct hl_state)) != 0) {
+        return 1;
+    }
+
+    // The state saved at the last checkpoint before the first out of date
+    // character only depends on characters that did not change
+    size_t k = hl->valid == 0 ? 0 : (hl->valid - 1) / HL_CHECKPOINT_INTERVAL;
+    struct hl_state st = hl->checkpoints[k];
+    size_t i = k * HL_CHECKPOINT_INTERVAL;
+    for (; i < len; i++) {
+        if (i % HL_CHECKPOINT_INTERVAL == 0) {
+            hl->checkpoints[i / HL_CHECKPOINT_INTERVAL] = st;
+        }
+        if (line[i] == ' ') {
+            if (st.in_word) {
+                finish_word(hl, &st, line, st.word_start, i);
+            }
+            hl->classes[i] = HL_DEFAULT;
+            // Stop at the first word boundary past what was asked for
+            if (i >= upto) {
+                i++;
+                break;
+            }
+        } else if (!st.in_word) {
+            st.in_word = 1;
+            st.word_start = i;
+        }
+    }
+    if (i == len && st.in_word) {
+        finish_word(hl, &st, line, st.word_start, len);
+    }
+    hl->valid = i;
+    return 0;
+}
+
+const char *hl_sequence(int class) {
+    return sequences[class];
+}
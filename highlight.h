@@ -0,0 +1,73 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stddef.h>
+
+// Highlighting classes of the characters of a command line
+#define HL_DEFAULT 0
+#define HL_COMMAND 1
+#define HL_OPTION 2
+#define HL_PIPE 3
+#define HL_REDIRECT 4
+#define HL_FILE 5
+
+// Lexer state at some position of the line
+struct hl_state {
+    unsigned char expect;       // Class of the next word
+    unsigned char seen_command; // 1 if the current pipeline stage has a command word
+    unsigned char in_word;
+    size_t word_start;
+};
+
+/*
+ * Incremental highlighter for a command line. The lexer state is saved every
+ * HL_CHECKPOINT_INTERVAL characters, so after an edit, lexing restarts from
+ * the last checkpoint before the change instead of the start of the line, and
+ * it only runs as far as the caller needs classes for.
+ */
+typedef struct {
+    unsigned char *classes;     // Class of each character of the line
+    size_t classes_cap;
+    struct hl_state *checkpoints;
+    size_t checkpoints_cap;
+    size_t valid;               // Classes before this position are up to date
+} highlighter_t;
+
+/*
+ * Initializes a highlighter for an empty line
+ * hl: Pointer to the highlighter to initialize
+ * Returns 0 on success, 1 on error
+ */
+int hl_init(highlighter_t *hl);
+
+/*
+ * Releases all memory held by a highlighter
+ * hl: Pointer to the highlighter to free
+ */
+void hl_free(highlighter_t *hl);
+
+/*
+ * Record that the line changed at and after a position
+ * hl: Pointer to the highlighter
+ * pos: Position of the first changed character
+ */
+void hl_invalidate(highlighter_t *hl, size_t pos);
+
+/*
+ * Bring the classes of the characters before 'upto' up to date
+ * hl: Pointer to the highlighter
+ * line: The line being highlighted
+ * len: Length of the line
+ * upto: Position up to which classes are needed
+ * Returns 0 on success, 1 on error
+ */
+int hl_update(highlighter_t *hl, const char *line, size_t len, size_t upto);
+
+/*
+ * Get the terminal escape sequence selecting the rendition of a class
+ * class: One of the HL_ classes
+ * Returns the escape sequence
+ */
+const char *hl_sequence(int class);
+
+#endif // HIGHLIGHT_H
@@ -0,0 +1,504 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hist_index.h"
+
+#define INITIAL_SIZE 1024
+#define INITIAL_LIST_SIZE 4
+
+#define SNAPSHOT_MAGIC "SHHTRI1"
+// A snapshot is saved once this many entries are indexed in memory
+#define SAVE_MIN 4096
+// A slot still empty this many seconds after indexing reached it, or this
+// far behind the newest entry, belongs to a shell that died appending it
+#define HOLE_TIMEOUT 2
+#define HOLE_DISTANCE 1024
+
+struct snapshot_header {
+    char magic[8];
+    uint64_t indexed;     // Number of history entries covered
+    uint64_t last_hash;   // Hash of the newest entry covered, to notice a replaced history
+    uint64_t n_lists;
+};
+
+// The header is followed by the lists sorted by key, then their entries
+struct snapshot_list {
+    uint32_t key;
+    uint32_t length;
+    uint64_t offset;      // Of the entries, from the start of the file
+};
+
+struct gram_list {
+    uint32_t key;        // Bytes of the trigram, or 0 for an empty slot
+    uint32_t length;
+    uint32_t capacity;
+    uint32_t *entries;   // Ascending indices of the entries containing the n-gram
+};
+
+// The top byte keeps every key non-zero
+static uint32_t gram_key(const char *s) {
+    return 1u << 24 | (unsigned char) s[0] << 16 | (unsigned char) s[1] << 8 | (unsigned char) s[2];
+}
+
+static size_t hash_key(uint32_t key, size_t capacity) {
+    return (key * 2654435761u) & (capacity - 1);
+}
+
+static struct gram_list *find_list(const hist_index_t *idx, uint32_t key) {
+    size_t i = hash_key(key, idx->capacity);
+    while (idx->lists[i].key != 0) {
+        if (idx->lists[i].key == key) {
+            return &idx->lists[i];
+        }
+        i = (i + 1) & (idx->capacity - 1);
+    }
+    return NULL;
+}
+
+static int grow_table(hist_index_t *idx) {
+    size_t new_capacity = idx->capacity * 2;
+    struct gram_list *new_lists = calloc(new_capacity, sizeof(struct gram_list));
+    if (new_lists == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < idx->capacity; i++) {
+        if (idx->lists[i].key == 0) {
+            continue;
+        }
+        size_t j = hash_key(idx->lists[i].key, new_capacity);
+        while (new_lists[j].key != 0) {
+            j = (j + 1) & (new_capacity - 1);
+        }
+        new_lists[j] = idx->lists[i];
+    }
+    free(idx->lists);
+    idx->lists = new_lists;
+    idx->capacity = new_capacity;
+    return 0;
+}
+
+/*
+ * Record that entry 'entry' contains the trigram 'key'
+ * Returns 0 on success, 1 on error
+ */
+static int add_posting(hist_index_t *idx, uint32_t key, uint32_t entry) {
+    struct gram_list *list = find_list(idx, key);
+    if (list == NULL) {
+        // Keep the table at most half full so probe sequences stay short
+        if (2 * (idx->n_lists + 1) > idx->capacity && grow_table(idx) != 0) {
+            return 1;
+        }
+        size_t i = hash_key(key, idx->capacity);
+        while (idx->lists[i].key != 0) {
+            i = (i + 1) & (idx->capacity - 1);
+        }
+        list = &idx->lists[i];
+        list->key = key;
+        idx->n_lists++;
+    }
+
+    // Entries are indexed in order, so a repeated trigram within one entry
+    // is always at the end of its list
+    if (list->length > 0 && list->entries[list->length - 1] == entry) {
+        return 0;
+    }
+    if (list->length == list->capacity) {
+        uint32_t new_capacity = list->capacity == 0 ? INITIAL_LIST_SIZE : 2 * list->capacity;
+        uint32_t *new_entries = realloc(list->entries, new_capacity * sizeof(uint32_t));
+        if (new_entries == NULL) {
+            return 1;
+        }
+        list->entries = new_entries;
+        list->capacity = new_capacity;
+    }
+    list->entries[list->length++] = entry;
+    return 0;
+}
+
+// FNV-1a of an entry, or 0 for a missing one
+static uint64_t hash_entry(const char *entry) {
+    if (entry == NULL) {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037UL;
+    for (; *entry != '\0'; entry++) {
+        hash = (hash ^ (unsigned char) *entry) * 1099511628211UL;
+    }
+    return hash;
+}
+
+static uint64_t last_hash(history_t *hist, uint64_t indexed) {
+    return indexed > 0 ? hash_entry(history_get(hist, indexed - 1)) : 0;
+}
+
+static void unmap_snapshot(hist_index_t *idx) {
+    if (idx->snapshot != NULL) {
+        munmap(idx->snapshot, idx->snapshot_size);
+    }
+    idx->snapshot = NULL;
+    idx->snapshot_size = 0;
+    idx->snapshot_lists = NULL;
+    idx->snapshot_n_lists = 0;
+    idx->snapshot_indexed = 0;
+}
+
+/*
+ * Map the snapshot saved at 'path' in place of the current one, if it is
+ * intact and covers more entries of 'hist' than the index has so far
+ * Returns 1 if the snapshot was mapped, 0 otherwise
+ */
+static int map_snapshot(hist_index_t *idx, history_t *hist, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(struct snapshot_header)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    // Every list must lie within the file, in order, for lookups to trust it
+    const struct snapshot_header *hdr = (const struct snapshot_header *) map;
+    const struct snapshot_list *lists = (const struct snapshot_list *) (map + sizeof(*hdr));
+    size_t size = st.st_size;
+    int ok = memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+             hdr->indexed > idx->indexed && hdr->indexed <= history_length(hist) &&
+             hdr->n_lists <= (size - sizeof(*hdr)) / sizeof(*lists) &&
+             hdr->last_hash == last_hash(hist, hdr->indexed);
+    for (uint64_t i = 0; ok && i < hdr->n_lists; i++) {
+        ok = (i == 0 || lists[i - 1].key < lists[i].key) && lists[i].offset % sizeof(uint32_t) == 0 &&
+             lists[i].offset <= size && lists[i].length <= (size - lists[i].offset) / sizeof(uint32_t);
+    }
+    if (!ok) {
+        munmap(map, size);
+        return 0;
+    }
+
+    unmap_snapshot(idx);
+    idx->snapshot = map;
+    idx->snapshot_size = size;
+    idx->snapshot_lists = lists;
+    idx->snapshot_n_lists = hdr->n_lists;
+    idx->snapshot_indexed = hdr->indexed;
+    return 1;
+}
+
+static const struct snapshot_list *find_snapshot_list(const hist_index_t *idx, uint32_t key) {
+    uint64_t lo = 0;
+    uint64_t hi = idx->snapshot_n_lists;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (idx->snapshot_lists[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < idx->snapshot_n_lists && idx->snapshot_lists[lo].key == key ? &idx->snapshot_lists[lo] : NULL;
+}
+
+static const uint32_t *snapshot_entries(const hist_index_t *idx, const struct snapshot_list *list) {
+    return (const uint32_t *) (idx->snapshot + list->offset);
+}
+
+static int compare_lists(const void *a, const void *b) {
+    uint32_t x = (*(struct gram_list *const *) a)->key;
+    uint32_t y = (*(struct gram_list *const *) b)->key;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Step through the snapshot lists and the sorted lists in memory together,
+ * one trigram at a time
+ * snap, mem: Set to the lists of the next trigram, or NULL where it has none
+ * Returns 1 while there is a trigram left, 0 at the end
+ */
+static int next_merged(const hist_index_t *idx, struct gram_list **sorted, size_t *i, size_t *j,
+                       const struct snapshot_list **snap, const struct gram_list **mem) {
+    *snap = *i < idx->snapshot_n_lists ? &idx->snapshot_lists[*i] : NULL;
+    *mem = *j < idx->n_lists ? sorted[*j] : NULL;
+    if (*snap == NULL && *mem == NULL) {
+        return 0;
+    }
+    if (*mem == NULL || (*snap != NULL && (*snap)->key < (*mem)->key)) {
+        *mem = NULL;
+    } else if (*snap == NULL || (*mem)->key < (*snap)->key) {
+        *snap = NULL;
+    }
+    *i += *snap != NULL;
+    *j += *mem != NULL;
+    return 1;
+}
+
+/*
+ * Write the snapshot lists merged with the lists in memory to 'path'. The
+ * file is written under a temporary name and renamed into place, so other
+ * shells never map a partial snapshot.
+ * Returns 0 on success, 1 on error
+ */
+static int write_snapshot(const hist_index_t *idx, history_t *hist, const char *path) {
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, getpid()) >= sizeof(tmp_path)) {
+        return 1;
+    }
+    struct gram_list **sorted = malloc((idx->n_lists > 0 ? idx->n_lists : 1) * sizeof(struct gram_list *));
+    if (sorted == NULL) {
+        return 1;
+    }
+    size_t n_sorted = 0;
+    for (size_t k = 0; k < idx->capacity; k++) {
+        if (idx->lists[k].key != 0) {
+            sorted[n_sorted++] = &idx->lists[k];
+        }
+    }
+    qsort(sorted, n_sorted, sizeof(struct gram_list *), compare_lists);
+
+    const struct snapshot_list *snap;
+    const struct gram_list *mem;
+    size_t i = 0;
+    size_t j = 0;
+    struct snapshot_header hdr = {SNAPSHOT_MAGIC, idx->indexed, last_hash(hist, idx->indexed), 0};
+    while (next_merged(idx, sorted, &i, &j, &snap, &mem)) {
+        hdr.n_lists++;
+    }
+
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        free(sorted);
+        return 1;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    uint64_t offset = sizeof(hdr) + hdr.n_lists * sizeof(struct snapshot_list);
+    i = j = 0;
+    while (next_merged(idx, sorted, &i, &j, &snap, &mem)) {
+        struct snapshot_list list = {snap != NULL ? snap->key : mem->key, 0, offset};
+        list.length = (snap != NULL ? snap->length : 0) + (mem != NULL ? mem->length : 0);
+        fwrite(&list, sizeof(list), 1, f);
+        offset += list.length * sizeof(uint32_t);
+    }
+    i = j = 0;
+    while (next_merged(idx, sorted, &i, &j, &snap, &mem)) {
+        // Entries in memory are all newer than those in the snapshot
+        if (snap != NULL) {
+            fwrite(snapshot_entries(idx, snap), sizeof(uint32_t), snap->length, f);
+        }
+        if (mem != NULL) {
+            fwrite(mem->entries, sizeof(uint32_t), mem->length, f);
+        }
+    }
+    free(sorted);
+
+    int ret = ferror(f) != 0;
+    ret |= fclose(f) != 0;
+    if (ret == 0 && rename(tmp_path, path) == -1) {
+        ret = 1;
+    }
+    if (ret != 0) {
+        unlink(tmp_path);
+    }
+    return ret;
+}
+
+static void clear_lists(hist_index_t *idx) {
+    for (size_t i = 0; i < idx->capacity; i++) {
+        free(idx->lists[i].entries);
+    }
+    memset(idx->lists, 0, idx->capacity * sizeof(struct gram_list));
+    idx->n_lists = 0;
+}
+
+/*
+ * Save everything indexed so far as the snapshot and continue with empty
+ * lists in memory. Another shell may have saved a snapshot covering more
+ * entries in the meantime, in which case that one is used instead, and
+ * indexing resumes after it.
+ */
+static void save_snapshot(hist_index_t *idx, history_t *hist) {
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s.tri", hist->path) >= sizeof(path)) {
+        idx->save = 0;
+        return;
+    }
+    if (map_snapshot(idx, hist, path)) {
+        clear_lists(idx);
+        idx->indexed = idx->snapshot_indexed;
+        return;
+    }
+    if (write_snapshot(idx, hist, path) != 0) {
+        // Keep indexing in memory only, say in a read-only directory
+        idx->save = 0;
+        return;
+    }
+    uint64_t indexed = idx->indexed;
+    idx->indexed = 0;
+    int mapped = map_snapshot(idx, hist, path);
+    idx->indexed = indexed;
+    if (!mapped) {
+        idx->save = 0;
+        return;
+    }
+    clear_lists(idx);
+    idx->indexed = idx->snapshot_indexed;
+}
+
+int hist_index_init(hist_index_t *idx) {
+    memset(idx, 0, sizeof(hist_index_t));
+    idx->save = 1;
+    idx->capacity = INITIAL_SIZE;
+    idx->lists = calloc(INITIAL_SIZE, sizeof(struct gram_list));
+    if (idx->lists == NULL) {
+        idx->capacity = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void hist_index_free(hist_index_t *idx) {
+    for (size_t i = 0; i < idx->capacity; i++) {
+        free(idx->lists[i].entries);
+    }
+    free(idx->lists);
+    unmap_snapshot(idx);
+    memset(idx, 0, sizeof(hist_index_t));
+}
+
+/*
+ * Decide whether to give up on the empty slot at 'i' of a history with 'n'
+ * entries. A slot is empty while another shell is appending to it, which
+ * takes moments, or for good if that shell died in between.
+ * Returns 1 to skip the slot, 0 to wait for it
+ */
+static int skip_hole(hist_index_t *idx, uint64_t i, uint64_t n) {
+    time_t now = time(NULL);
+    if (idx->hole != i || idx->hole_seen == 0) {
+        idx->hole = i;
+        idx->hole_seen = now;
+    }
+    return n - i > HOLE_DISTANCE || now - idx->hole_seen >= HOLE_TIMEOUT;
+}
+
+int hist_index_update(hist_index_t *idx, history_t *hist) {
+    if (!idx->loaded) {
+        char path[4096];
+        if (snprintf(path, sizeof(path), "%s.tri", hist->path) < sizeof(path) && map_snapshot(idx, hist, path)) {
+            idx->indexed = idx->snapshot_indexed;
+        }
+        idx->loaded = 1;
+    }
+
+    uint64_t n = history_length(hist);
+    while (idx->indexed < n) {
+        const char *entry = history_get(hist, idx->indexed);
+        if (entry == NULL && !skip_hole(idx, idx->indexed, n)) {
+            // Still being written by another shell, pick it up next time
+            break;
+        }
+        size_t len = entry != NULL ? strlen(entry) : 0;
+        for (size_t i = 0; i + 3 <= len; i++) {
+            if (add_posting(idx, gram_key(entry + i), idx->indexed) != 0) {
+                return 1;
+            }
+        }
+        idx->indexed++;
+
+        // Catching up on a long history saves in doubling steps, so the lists
+        // in memory never cover more entries than the snapshot does
+        uint64_t in_memory = idx->indexed - idx->snapshot_indexed;
+        if (idx->save && in_memory >= SAVE_MIN && in_memory >= idx->snapshot_indexed) {
+            save_snapshot(idx, hist);
+        }
+    }
+    if (idx->save && idx->indexed - idx->snapshot_indexed >= SAVE_MIN) {
+        save_snapshot(idx, hist);
+    }
+    return 0;
+}
+
+/*
+ * Check the entries of a list older than 'before', from newest to oldest
+ * Returns the index of the first one containing 'query', or -1 if none does
+ */
+static int64_t search_list(const uint32_t *entries, uint32_t length, history_t *hist, const char *query,
+                           uint64_t before) {
+    // Binary search for the first posting at or after 'before'
+    uint32_t lo = 0;
+    uint32_t hi = length;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (entries[mid] < before) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (uint32_t i = lo; i > 0; i--) {
+        const char *entry = history_get(hist, entries[i - 1]);
+        if (entry != NULL && strstr(entry, query) != NULL) {
+            return entries[i - 1];
+        }
+    }
+    return -1;
+}
+
+int64_t hist_index_search(const hist_index_t *idx, history_t *hist, const char *query, uint64_t before) {
+    size_t query_len = strlen(query);
+    if (before > idx->indexed) {
+        before = idx->indexed;
+    }
+
+    if (query_len == 0) {
+        return -1;
+    }
+
+    // Lists of single bytes and pairs would name nearly every entry, tripling
+    // the size of the index, so a query that short is checked against the
+    // entries directly. Going from newest to oldest, it almost always
+    // matches within a few.
+    if (query_len < 3) {
+        for (uint64_t i = before; i > 0; i--) {
+            const char *entry = history_get(hist, i - 1);
+            if (entry != NULL && strstr(entry, query) != NULL) {
+                return i - 1;
+            }
+        }
+        return -1;
+    }
+
+    const struct gram_list *mem = NULL;
+    const struct snapshot_list *snap = NULL;
+    uint64_t shortest = UINT64_MAX;
+    for (size_t i = 0; i + 3 <= query_len; i++) {
+        uint32_t key = gram_key(query + i);
+        const struct gram_list *m = find_list(idx, key);
+        const struct snapshot_list *s = find_snapshot_list(idx, key);
+        uint64_t length = (m != NULL ? m->length : 0) + (s != NULL ? s->length : 0);
+        if (length == 0) {
+            return -1;
+        }
+        if (length < shortest) {
+            shortest = length;
+            mem = m;
+            snap = s;
+        }
+    }
+
+    // Entries in memory are all newer than those in the snapshot
+    int64_t found = -1;
+    if (mem != NULL) {
+        found = search_list(mem->entries, mem->length, hist, query, before);
+    }
+    if (found < 0 && snap != NULL) {
+        found = search_list(snapshot_entries(idx, snap), snap->length, hist, query, before);
+    }
+    return found;
+}
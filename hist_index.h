@@ -0,0 +1,77 @@
+#ifndef HIST_INDEX_H
+#define HIST_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "history.h"
+
+struct gram_list;
+struct snapshot_list;
+
+/*
+ * Trigram index over the entries of a history. For every sequence of three
+ * bytes that appears in some entry, the index keeps the ascending list of
+ * entries containing it, so a substring search only has to check the entries
+ * in the shortest list among the query's trigrams instead of every entry.
+ *
+ * The lists are saved next to the history file, with a ".tri" suffix, and
+ * mapped by the next shell to search, so only entries appended since the
+ * last save are indexed in memory. Whichever shell has indexed enough new
+ * entries writes a fresh snapshot and replaces the old one in a single
+ * rename.
+ */
+typedef struct {
+    struct gram_list *lists;     // Open-addressing hash table keyed by trigram, for entries since the snapshot
+    size_t n_lists;
+    size_t capacity;
+    uint64_t indexed;            // Number of history entries indexed so far
+
+    char *snapshot;              // Mapping of the saved lists, or NULL
+    size_t snapshot_size;
+    const struct snapshot_list *snapshot_lists;  // Sorted by trigram
+    uint64_t snapshot_n_lists;
+    uint64_t snapshot_indexed;   // Number of history entries the snapshot covers
+    int loaded;                  // 1 once the saved snapshot has been looked for
+    int save;                    // 0 once saving has failed, to stop retrying
+
+    uint64_t hole;               // Empty slot indexing is waiting on
+    time_t hole_seen;            // When indexing first waited on it
+} hist_index_t;
+
+/*
+ * Initializes a new, empty history index
+ * idx: Pointer to the index to initialize
+ * Returns 0 on success, 1 on error
+ */
+int hist_index_init(hist_index_t *idx);
+
+/*
+ * Releases all memory held by a history index
+ * idx: Pointer to the index to free
+ */
+void hist_index_free(hist_index_t *idx);
+
+/*
+ * Add the entries appended to a history since the last update to an index,
+ * loading the saved snapshot on the first update and saving a new one once
+ * enough entries have been added. A slot left empty by a shell that died
+ * while appending is skipped once it has stayed empty for a while.
+ * idx: Pointer to the index
+ * hist: History the index covers
+ * Returns 0 on success, 1 on error
+ */
+int hist_index_update(hist_index_t *idx, history_t *hist);
+
+/*
+ * Find the most recent history entry older than 'before' that contains 'query'
+ * idx: Pointer to an up-to-date index of 'hist'
+ * hist: History to search
+ * query: String to search for
+ * before: Only entries with an index less than this are considered
+ * Returns the index of the matching entry, or -1 if there is none
+ */
+int64_t hist_index_search(const hist_index_t *idx, history_t *hist, const char *query, uint64_t before);
+
+#endif // HIST_INDEX_H
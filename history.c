@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "io_util.h"
+
+#define DATA_MAGIC "SHHIST1"
+#define INDEX_MAGIC "SHHIDX1"
+#define HEADER_SIZE 64
+
+// Files are mapped once at these sizes and grow underneath the mapping, so
+// entries appended by other shells are visible without remapping
+#define DATA_MAP_SIZE (1UL << 30)
+#define INDEX_MAP_SIZE (1UL << 27)
+#define INDEX_CAPACITY ((INDEX_MAP_SIZE - HEADER_SIZE) / sizeof(uint64_t))
+
+struct hist_header {
+    char magic[8];
+    _Atomic uint64_t next;  // Record file: next free byte. Index file: number of slots.
+};
+
+// Each record is a 32-bit length followed by the text and its terminator,
+// padded to 8 bytes
+#define RECORD_SIZE(len) ((sizeof(uint32_t) + (len) + 1 + 7) & ~7UL)
+
+/*
+ * Open a history file, creating it with an initialized header if it does not
+ * exist. The header is written to a private file that is then linked into
+ * place, so concurrent shells never observe or clobber a partial header.
+ * Returns the file descriptor on success, -1 on error
+ */
+static int open_file(const char *path, const char *magic, uint64_t first) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd != -1 || errno != ENOENT) {
+        return fd;
+    }
+
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, getpid()) >= sizeof(tmp_path)) {
+        return -1;
+    }
+    int tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (tmp_fd == -1) {
+        return -1;
+    }
+
+    char header[HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, magic, strlen(magic) + 1);
+    memcpy(header + offsetof(struct hist_header, next), &first, sizeof(first));
+    int ret = write_all(tmp_fd, header, sizeof(header), 0);
+    if (ret == 0 && link(tmp_path, path) == -1 && errno != EEXIST) {
+        ret = 1;
+    }
+    unlink(tmp_path);
+    close(tmp_fd);
+    if (ret != 0) {
+        return -1;
+    }
+
+    return open(path, O_RDWR | O_CLOEXEC);
+}
+
+/*
+ * Map a history file and check its header
+ * Returns the mapping on success, NULL on error
+ */
+static void *map_file(int fd, size_t size, const char *magic) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < HEADER_SIZE) {
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    if (memcmp(map, magic, strlen(magic) + 1) != 0) {
+        munmap(map, size);
+        return NULL;
+    }
+    return map;
+}
+
+int history_open(history_t *hist, const char *path) {
+    memset(hist, 0, sizeof(history_t));
+    hist->data_fd = -1;
+    hist->index_fd = -1;
+
+    char index_path[4096];
+    if (snprintf(index_path, sizeof(index_path), "%s.idx", path) >= sizeof(index_path)) {
+        return 1;
+    }
+    if ((hist->path = strdup(path)) == NULL) {
+        return 1;
+    }
+
+    if ((hist->data_fd = open_file(path, DATA_MAGIC, HEADER_SIZE)) == -1 ||
+        (hist->index_fd = open_file(index_path, INDEX_MAGIC, 0)) == -1) {
+        history_close(hist);
+        return 1;
+    }
+
+    hist->data = map_file(hist->data_fd, DATA_MAP_SIZE, DATA_MAGIC);
+    if (hist->data == NULL) {
+        history_close(hist);
+        return 1;
+    }
+    hist->data_hdr = (struct hist_header *) hist->data;
+
+    char *index = map_file(hist->index_fd, INDEX_MAP_SIZE, INDEX_MAGIC);
+    if (index == NULL) {
+        history_close(hist);
+        return 1;
+    }
+    hist->index_hdr = (struct hist_header *) index;
+    hist->offsets = (uint64_t *) (index + HEADER_SIZE);
+
+    return 0;
+}
+
+void history_close(history_t *hist) {
+    if (hist->data != NULL) {
+        munmap(hist->data, DATA_MAP_SIZE);
+    }
+    if (hist->index_hdr != NULL) {
+        munmap(hist->index_hdr, INDEX_MAP_SIZE);
+    }
+    if (hist->data_fd != -1) {
+        close(hist->data_fd);
+    }
+    if (hist->index_fd != -1) {
+        close(hist->index_fd);
+    }
+    free(hist->path);
+    memset(hist, 0, sizeof(history_t));
+    hist->data_fd = -1;
+    hist->index_fd = -1;
+}
+
+uint64_t history_length(history_t *hist) {
+    if (hist->index_hdr == NULL) {
+        return 0;
+    }
+    uint64_t n = atomic_load_explicit(&hist->index_hdr->next, memory_order_acquire);
+    return n < INDEX_CAPACITY ? n : INDEX_CAPACITY;
+}
+
+/*
+ * Check that the first 'end' bytes of the record file are backed by it,
+ * looking at its size again if they were not the last time
+ * Returns 1 if they are, 0 otherwise
+ */
+static int data_covers(history_t *hist, uint64_t end) {
+    if (end <= hist->data_size) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(hist->data_fd, &st) == -1) {
+        return 0;
+    }
+    hist->data_size = st.st_size < DATA_MAP_SIZE ? st.st_size : DATA_MAP_SIZE;
+    return end <= hist->data_size;
+}
+
+const char *history_get(history_t *hist, uint64_t i) {
+    if (i >= history_length(hist)) {
+        return NULL;
+    }
+
+    // A slot can be counted before the shell appending it has extended the
+    // index file, and touching the mapping past the end of the file faults
+    if (i >= hist->index_slots) {
+        struct stat st;
+        if (fstat(hist->index_fd, &st) == -1) {
+            return NULL;
+        }
+        hist->index_slots = (st.st_size - HEADER_SIZE) / sizeof(uint64_t);
+        if (i >= hist->index_slots) {
+            return NULL;
+        }
+    }
+
+    // A damaged index or record must not send reads past the record file,
+    // and the text must be terminated within it
+    uint64_t offset = __atomic_load_n(&hist->offsets[i], __ATOMIC_ACQUIRE);
+    if (offset < HEADER_SIZE || offset > DATA_MAP_SIZE || !data_covers(hist, offset + sizeof(uint32_t))) {
+        return NULL;
+    }
+    uint32_t len;
+    memcpy(&len, hist->data + offset, sizeof(len));
+    uint64_t end = offset + sizeof(uint32_t) + len + 1;
+    if (!data_covers(hist, end) || hist->data[end - 1] != '\0') {
+        return NULL;
+    }
+    return hist->data + offset + sizeof(uint32_t);
+}
+
+int history_add(history_t *hist, const char *line) {
+    if (hist->data == NULL || line[0] == '\0') {
+        return 0;
+    }
+    uint64_t n = history_length(hist);
+    if (n > 0) {
+        const char *last = history_get(hist, n - 1);
+        if (last != NULL && strcmp(last, line) == 0) {
+            return 0;
+        }
+    }
+
+    uint32_t len = strlen(line);
+    uint64_t size = RECORD_SIZE(len);
+    uint64_t offset = atomic_fetch_add(&hist->data_hdr->next, size);
+    if (offset + size > DATA_MAP_SIZE) {
+        return 1;
+    }
+
+    // The record is written with pwrite rather than through the mapping: it
+    // extends the file to cover the reservation without ever truncating
+    // records that other shells have reserved further along. Its parts are
+    // written in place, so adding a line allocates nothing.
+    static const char padding[8];
+    uint64_t text_end = sizeof(len) + len;
+    if (write_all(hist->data_fd, &len, sizeof(len), offset) != 0 ||
+        write_all(hist->data_fd, line, len, offset + sizeof(len)) != 0 ||
+        write_all(hist->data_fd, padding, size - text_end, offset + text_end) != 0) {
+        return 1;
+    }
+
+    // Publish the record only once its text is in place
+    uint64_t slot = atomic_fetch_add(&hist->index_hdr->next, 1);
+    if (slot >= INDEX_CAPACITY) {
+        return 1;
+    }
+    return write_all(hist->index_fd, &offset, sizeof(offset), HEADER_SIZE + slot * sizeof(uint64_t));
+}
@@ -0,0 +1,69 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+struct hist_header;
+
+/*
+ * Command history shared by every shell using the same history file. The
+ * history is stored in two append-only files that are mapped into memory:
+ * a record file holding the text of each command, and an index file holding
+ * the offset of each record. Nothing is parsed when the history is opened,
+ * and appends reserve space with atomic operations on the shared headers so
+ * concurrent shells never wait for each other.
+ */
+typedef struct {
+    char *path;                    // Path of the record file, which other files are named after
+    int data_fd;
+    int index_fd;
+    char *data;                    // Mapping of the record file
+    struct hist_header *data_hdr;
+    struct hist_header *index_hdr;
+    uint64_t *offsets;             // Record offsets, in the index file mapping
+    uint64_t index_slots;          // Number of index slots known to be backed by the file
+    uint64_t data_size;            // Number of record file bytes known to be backed by the file
+} history_t;
+
+/*
+ * Opens (creating if necessary) the history stored at 'path'. The index is
+ * kept next to it in 'path' with an ".idx" suffix.
+ * hist: Pointer to the history to initialize
+ * path: Path of the history record file
+ * Returns 0 on success, 1 on error
+ */
+int history_open(history_t *hist, const char *path);
+
+/*
+ * Unmaps and closes a history
+ * hist: Pointer to the history to close
+ */
+void history_close(history_t *hist);
+
+/*
+ * Determine the number of entries in a history, including entries appended
+ * by other shells since it was opened
+ * hist: Pointer to the history
+ * Returns the number of entries
+ */
+uint64_t history_length(history_t *hist);
+
+/*
+ * Retrieve an entry from a history
+ * hist: Pointer to the history
+ * i: Index of the entry (0 is the oldest)
+ * Returns the entry (not a copy), or NULL if 'i' is out of range or the entry
+ * is still being written by another shell
+ */
+const char *history_get(history_t *hist, uint64_t i);
+
+/*
+ * Append a command to a history. Empty lines and repeats of the most recent
+ * entry are not recorded.
+ * hist: Pointer to the history
+ * line: Command to append
+ * Returns 0 on success, 1 on error
+ */
+int history_add(history_t *hist, const char *line);
+
+#endif // HISTORY_H
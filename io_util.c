@@ -0,0 +1,59 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "io_util.h"
+
+long long parse_size(const char *value) {
+    char *end;
+    long long size = strtoll(value, &end, 10);
+    switch (*end) {
+    case 'T': case 't': size <<= 10; // fall through
+    case 'G': case 'g': size <<= 10; // fall through
+    case 'M': case 'm': size <<= 10; // fall through
+    case 'K': case 'k': size <<= 10;
+    }
+    return end != value && size > 0 ? size : 0;
+}
+
+int write_all(int fd, const void *buf, size_t n, off_t offset) {
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t written = offset != -1 ? pwrite(fd, p, n, offset) : write(fd, p, n);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        p += written;
+        n -= written;
+        if (offset != -1) {
+            offset += written;
+        }
+    }
+    return 0;
+}
+
+int writev_all(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        // Skip what was written, which may end part of the way into a buffer
+        while (n > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef IO_UTIL_H
+#define IO_UTIL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Parse a size given in an environment variable, e.g. "65536", "16M" or
+ * "100G". A K, M, G or T suffix multiplies the number by a power of 1024.
+ * value: String to parse
+ * Returns the size, or 0 if 'value' does not start with a positive number
+ */
+long long parse_size(const char *value);
+
+/*
+ * Write a whole buffer, retrying on short writes and interruptions
+ * fd: Descriptor to write to
+ * buf: Data to write
+ * n: Number of bytes to write
+ * offset: Position to write at with pwrite, or -1 to write with write at the
+ *         descriptor's current position
+ * Returns 0 on success, 1 on error
+ */
+int write_all(int fd, const void *buf, size_t n, off_t offset);
+
+/*
+ * Write a whole array of buffers, retrying on short writes and interruptions
+ * fd: Descriptor to write to
+ * iov: Buffers to write, which are updated to skip what has been written
+ * n: Number of buffers
+ * Returns 0 on success, 1 on error
+ */
+int writev_all(int fd, struct iovec *iov, int n);
+
+#endif // IO_UTIL_H
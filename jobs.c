@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "io_util.h"
+#include "shell_funcs.h"
+#include "jobs.h"
+
+// Bytes read from one job's pipe at a time, so a busy job cannot hold up the others
+#define READ_SIZE 65536
+// Output held for one job before it is printed even without a line break
+#define PENDING_MAX (1 << 20)
+#define MAX_EVENTS 64
+
+// Output of many jobs gathered for a single writev()
+struct batch {
+    struct iovec iov[IOV_MAX];
+    int n;
+};
+
+static int batch_flush(struct batch *b) {
+    int ret = writev_all(STDOUT_FILENO, b->iov, b->n);
+    b->n = 0;
+    return ret;
+}
+
+static int batch_add(struct batch *b, const void *data, size_t len) {
+    if (b->n == IOV_MAX && batch_flush(b) != 0) {
+        return 1;
+    }
+    b->iov[b->n].iov_base = (void *) data;
+    b->iov[b->n].iov_len = len;
+    b->n++;
+    return 0;
+}
+
+/*
+ * Add the output of a job that is ready to be printed to a batch
+ * ended: 1 if the job will write nothing more
+ * Returns the number of bytes of the job's buffer added, or -1 on error
+ */
+static ssize_t batch_job(const jobs_t *jobs, const job_t *job, struct batch *b, int ended) {
+    size_t end = job->len;
+    if (!ended && end < PENDING_MAX) {
+        if (jobs->mode == GROUP_BLOCKS) {
+            return 0;
+        }
+        // A line still being written is kept until it is complete
+        char *newline = memrchr(job->buf, '\n', job->len);
+        end = newline == NULL ? 0 : newline - job->buf + 1;
+    }
+    if (end == 0) {
+        return 0;
+    }
+
+    if (!jobs->tags) {
+        if (batch_add(b, job->buf, end) != 0) {
+            return -1;
+        }
+    } else {
+        size_t start = 0;
+        while (start < end) {
+            char *newline = memchr(job->buf + start, '\n', end - start);
+            size_t line_end = newline == NULL ? end : newline - job->buf + 1;
+            if (batch_add(b, job->tag, strlen(job->tag)) != 0 ||
+                batch_add(b, job->buf + start, line_end - start) != 0) {
+                return -1;
+            }
+            start = line_end;
+        }
+    }
+    // Output cut short ends its line, so the next job's starts on its own
+    if (job->buf[end - 1] != '\n' && batch_add(b, "\n", 1) != 0) {
+        return -1;
+    }
+    return end;
+}
+
+static job_t *find_job(jobs_t *jobs, int id) {
+    for (unsigned i = 0; i < jobs->n_jobs; i++) {
+        if (jobs->jobs[i].id == id) {
+            return &jobs->jobs[i];
+        }
+    }
+    return NULL;
+}
+
+static void close_output(jobs_t *jobs, job_t *job) {
+    if (!job->coproc) {
+        epoll_ctl(jobs->epoll_fd, EPOLL_CTL_DEL, job->out_fd, NULL);
+    }
+    close(job->out_fd);
+    job->out_fd = -1;
+}
+
+static int reserve_output(job_t *job) {
+    if (job->cap - job->len < READ_SIZE) {
+        size_t new_cap = job->cap == 0 ? READ_SIZE : 2 * job->cap;
+        while (new_cap - job->len < READ_SIZE) {
+            new_cap *= 2;
+        }
+        char *new_buf = realloc(job->buf, new_cap);
+        if (new_buf == NULL) {
+            return 1;
+        }
+        job->buf = new_buf;
+        job->cap = new_cap;
+    }
+    return 0;
+}
+
+/*
+ * Read what a job has written since it was last read
+ * Returns 0 on success, 1 on error
+ */
+static int read_output(jobs_t *jobs, job_t *job) {
+    if (reserve_output(job) != 0) {
+        return 1;
+    }
+    ssize_t n = read(job->out_fd, job->buf + job->len, READ_SIZE);
+    if (n > 0) {
+        job->len += n;
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close_output(jobs, job);
+    }
+    return 0;
+}
+
+static void free_job(job_t *job) {
+    if (job->in_fd != -1) {
+        close(job->in_fd);
+    }
+    if (job->coproc && job->out_fd != -1) {
+        close(job->out_fd);
+    }
+    free(job->command);
+    free(job->pids);
+    free(job->buf);
+}
+
+int jobs_init(jobs_t *jobs) {
+    memset(jobs, 0, sizeof(jobs_t));
+    jobs->epoll_fd = -1;
+
+    const char *value = getenv(GROUP_OUTPUT_VAR);
+    if (value == NULL) {
+        return 0;
+    }
+    jobs->mode = GROUP_LINES;
+    char words[64];
+    snprintf(words, sizeof(words), "%s", value);
+    char *save = NULL;
+    for (char *word = strtok_r(words, ",", &save); word != NULL; word = strtok_r(NULL, ",", &save)) {
+        if (strcmp(word, "blocks") == 0) {
+            jobs->mode = GROUP_BLOCKS;
+        } else if (strcmp(word, "lines") == 0) {
+            jobs->mode = GROUP_LINES;
+        } else if (strcmp(word, "tags") == 0) {
+            jobs->tags = 1;
+        }
+    }
+
+    // Without epoll, jobs simply write to the terminal themselves
+    jobs->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (jobs->epoll_fd == -1) {
+        perror("jobs: epoll_create1");
+        jobs->mode = GROUP_NONE;
+        return 1;
+    }
+    return 0;
+}
+
+void jobs_free(jobs_t *jobs) {
+    // A coprocess sees the end of its input
+    for (unsigned i = 0; i < jobs->n_jobs; i++) {
+        if (jobs->jobs[i].out_fd != -1 && !jobs->jobs[i].coproc) {
+            close(jobs->jobs[i].out_fd);
+        }
+        free_job(&jobs->jobs[i]);
+    }
+    free(jobs->jobs);
+    if (jobs->epoll_fd != -1) {
+        close(jobs->epoll_fd);
+    }
+    memset(jobs, 0, sizeof(jobs_t));
+    jobs->epoll_fd = -1;
+}
+
+int jobs_start(jobs_t *jobs, strvec_t *tokens, cmd_cache_t *cache, exec_cache_t *exec_cache, arena_t *arena,
+               int coproc) {
+    if (coproc && jobs_coproc(jobs) != NULL) {
+        fprintf(stderr, "coproc: a coprocess is already running\n");
+        return 1;
+    }
+    pipeline_t p;
+    if (plan_pipeline(tokens, cache, arena, &p) != 0) {
+        return 1;
+    }
+
+    // Everything the job needs is allocated before it is started, as its
+    // processes could not be kept track of otherwise
+    if (jobs->n_jobs == jobs->capacity) {
+        unsigned new_capacity = jobs->capacity == 0 ? 4 : 2 * jobs->capacity;
+        job_t *new_jobs = realloc(jobs->jobs, new_capacity * sizeof(job_t));
+        if (new_jobs == NULL) {
+            fprintf(stderr, "Error realloc\n");
+            return 1;
+        }
+        jobs->jobs = new_jobs;
+        jobs->capacity = new_capacity;
+    }
+    job_t *job = &jobs->jobs[jobs->n_jobs];
+    memset(job, 0, sizeof(job_t));
+    job->in_fd = -1;
+    job->out_fd = -1;
+    // The tokens live in the line's arena, so the command line is copied
+    size_t len = 0;
+    for (unsigned i = 0; i < tokens->length; i++) {
+        len += strlen(strvec_get(tokens, i)) + 1;
+    }
+    job->command = malloc(len);
+    job->pids = malloc(p.ncommands * sizeof(pid_t));
+    if (job->command == NULL || job->pids == NULL) {
+        fprintf(stderr, "Error malloc\n");
+        free_job(job);
+        return 1;
+    }
+    char *c = job->command;
+    for (unsigned i = 0; i < tokens->length; i++) {
+        const char *token = strvec_get(tokens, i);
+        size_t n = strlen(token);
+        memcpy(c, token, n);
+        c[n] = i + 1 < tokens->length ? ' ' : '\0';
+        c += n + 1;
+    }
+
+    // The shell keeps the write end of a coprocess's input, which none of
+    // its commands may hold, or it would never see the end of its input
+    int in_fds[2] = {-1, -1};
+    if (coproc && pipe2(in_fds, O_CLOEXEC) == -1) {
+        perror("coproc: pipe");
+        free_job(job);
+        return 1;
+    }
+    p.background = 1;
+    p.in_fd = in_fds[0];
+    int grouped = jobs->mode != GROUP_NONE;
+    if (start_pipeline(&p, exec_cache, grouped || coproc) != 0) {
+        if (coproc) {
+            close(in_fds[0]);
+            close(in_fds[1]);
+        }
+        free_job(job);
+        return 1;
+    }
+    memcpy(job->pids, p.pids, p.n_started * sizeof(pid_t));
+    job->n_running = p.n_started;
+    job->id = jobs->n_jobs == 0 ? 1 : jobs->jobs[jobs->n_jobs-1].id + 1;
+    snprintf(job->tag, sizeof(job->tag), "[%d] ", job->id);
+    jobs->n_jobs++;
+
+    if (coproc) {
+        close(in_fds[0]);
+        job->coproc = 1;
+        job->in_fd = in_fds[1];
+        job->out_fd = p.out_fd;
+        fcntl(job->out_fd, F_SETFD, FD_CLOEXEC);
+    } else if (grouped) {
+        // Later children must not hold the pipe open, and reading it must
+        // never block the shell
+        job->out_fd = p.out_fd;
+        fcntl(job->out_fd, F_SETFD, FD_CLOEXEC);
+        fcntl(job->out_fd, F_SETFL, O_NONBLOCK);
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = job->id };
+        if (epoll_ctl(jobs->epoll_fd, EPOLL_CTL_ADD, job->out_fd, &event) == -1) {
+            perror("jobs: epoll_ctl");
+            close(job->out_fd);
+            job->out_fd = -1;
+        }
+    }
+    printf("[%d] %d\n", job->id, (int) job->pids[job->n_running-1]);
+    fflush(stdout);
+    return 0;
+}
+
+int jobs_output_fd(const jobs_t *jobs) {
+    return jobs->epoll_fd;
+}
+
+int jobs_print_output(jobs_t *jobs, int timeout) {
+    if (jobs->epoll_fd == -1) {
+        return 0;
+    }
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(jobs->epoll_fd, events, MAX_EVENTS, timeout);
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        perror("jobs: epoll_wait");
+        return 1;
+    }
+    for (int i = 0; i < n; i++) {
+        job_t *job = find_job(jobs, events[i].data.u32);
+        if (job != NULL && job->out_fd != -1 && read_output(jobs, job) != 0) {
+            fprintf(stderr, "Error realloc\n");
+            return 1;
+        }
+    }
+
+    if (jobs->n_jobs == 0) {
+        return 0;
+    }
+
+    // The lines of all jobs go out in one writev(), after anything the shell
+    // printed itself
+    fflush(stdout);
+    static struct batch b;
+    size_t printed[jobs->n_jobs];
+    int ret = 0;
+    for (unsigned i = 0; i < jobs->n_jobs && ret == 0; i++) {
+        job_t *job = &jobs->jobs[i];
+        // The output of a coprocess is for the shell to read
+        ssize_t added = job->coproc ? 0 : batch_job(jobs, job, &b, job->out_fd == -1);
+        printed[i] = added > 0 ? added : 0;
+        ret = added == -1;
+    }
+    if (batch_flush(&b) != 0) {
+        ret = 1;
+    }
+    // What is printed is dropped only now, as the batch points into the buffers
+    for (unsigned i = 0; i < jobs->n_jobs; i++) {
+        job_t *job = &jobs->jobs[i];
+        if (ret == 0 && printed[i] > 0) {
+            memmove(job->buf, job->buf + printed[i], job->len - printed[i]);
+            job->len -= printed[i];
+        }
+    }
+    return ret;
+}
+
+void jobs_reap(jobs_t *jobs) {
+    unsigned kept = 0;
+    for (unsigned i = 0; i < jobs->n_jobs; i++) {
+        job_t *job = &jobs->jobs[i];
+        for (int j = job->n_running-1; j >= 0; j--) {
+            pid_t pid = waitpid(job->pids[j], NULL, WNOHANG);
+            if (pid == job->pids[j] || (pid == -1 && errno == ECHILD)) {
+                job->pids[j] = job->pids[--job->n_running];
+            }
+        }
+        // A job is only done once all of its output has been printed. What a
+        // coprocess wrote and was not read is dropped.
+        if (job->n_running == 0 && (job->coproc || (job->out_fd == -1 && job->len == 0))) {
+            printf("[%d] Done %s\n", job->id, job->command);
+            free_job(job);
+        } else {
+            jobs->jobs[kept++] = *job;
+        }
+    }
+    jobs->n_jobs = kept;
+    fflush(stdout);
+}
+
+int jobs_finish(jobs_t *jobs) {
+    while (1) {
+        int open = 0;
+        for (unsigned i = 0; i < jobs->n_jobs; i++) {
+            open |= jobs->jobs[i].out_fd != -1 && !jobs->jobs[i].coproc;
+        }
+        if (!open) {
+            return 0;
+        }
+        if (jobs_print_output(jobs, -1) != 0) {
+            return 1;
+        }
+    }
+}
+
+job_t *jobs_coproc(jobs_t *jobs) {
+    for (unsigned i = 0; i < jobs->n_jobs; i++) {
+        if (jobs->jobs[i].coproc) {
+            return &jobs->jobs[i];
+        }
+    }
+    return NULL;
+}
+
+int jobs_coproc_write(job_t *job, const char *data, size_t len) {
+    if (job->in_fd == -1) {
+        errno = EPIPE;
+        return 1;
+    }
+    // A coprocess that has exited must not take the shell down with SIGPIPE.
+    // Children are not started meanwhile, so none inherits the ignored signal.
+    struct sigaction ignore = { .sa_handler = SIG_IGN };
+    struct sigaction saved;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, &saved);
+    int ret = write_all(job->in_fd, data, len, -1);
+    sigaction(SIGPIPE, &saved, NULL);
+    return ret;
+}
+
+int jobs_coproc_read(job_t *job, unsigned n_lines, int fd) {
+    size_t start = 0;
+    while (n_lines > 0) {
+        char *newline = job->len > start ? memchr(job->buf + start, '\n', job->len - start) : NULL;
+        if (newline != NULL) {
+            start = newline - job->buf + 1;
+            n_lines--;
+            continue;
+        }
+        if (job->out_fd == -1 || reserve_output(job) != 0) {
+            break;
+        }
+        ssize_t n = read(job->out_fd, job->buf + job->len, READ_SIZE);
+        if (n == -1) {
+            break;
+        } else if (n == 0) {
+            close(job->out_fd);
+            job->out_fd = -1;
+            break;
+        }
+        job->len += n;
+    }
+
+    // The lines read are copied even if fewer than asked for, and the rest
+    // is kept for the next read
+    int saved_errno = errno;
+    int ret = write_all(fd, job->buf, start, -1);
+    memmove(job->buf, job->buf + start, job->len - start);
+    job->len -= start;
+    errno = saved_errno;
+    return ret != 0 || n_lines > 0;
+}
+
+void jobs_coproc_close(job_t *job) {
+    if (job->in_fd != -1) {
+        close(job->in_fd);
+        job->in_fd = -1;
+    }
+}
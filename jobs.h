@@ -0,0 +1,144 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "cmd_cache.h"
+#include "exec_cache.h"
+#include "string_vector.h"
+
+#define GROUP_OUTPUT_VAR "SHELL_GROUP_OUTPUT"
+
+// How the output of background jobs reaches the terminal
+enum {
+    GROUP_NONE,     // Jobs write to the terminal themselves
+    GROUP_LINES,    // Whole lines are printed as they complete
+    GROUP_BLOCKS,   // All of a job's output is printed together when it ends
+};
+
+// A pipeline running in the background
+typedef struct {
+    int id;
+    char *command;          // Command line, for messages
+    pid_t *pids;            // Processes of the commands still running
+    int n_running;
+    int out_fd;             // Read end of the job's output pipe, or -1
+    int in_fd;              // Write end of a coprocess's input pipe, or -1
+    int coproc;             // 1 if the shell reads and writes the job itself
+    char tag[16];           // Printed before each line of output if tags are on
+    char *buf;              // Output not printed (or for a coprocess, not read) yet
+    size_t len;
+    size_t cap;
+} job_t;
+
+/*
+ * Table of background jobs. With grouped output, each job writes to a pipe of
+ * its own, and the shell prints what they write without mixing their lines,
+ * batching the lines of all jobs into one writev().
+ */
+typedef struct {
+    job_t *jobs;
+    unsigned n_jobs;
+    unsigned capacity;
+    int mode;               // One of GROUP_NONE, GROUP_LINES or GROUP_BLOCKS
+    int tags;               // 1 to start each line with the id of its job
+    int epoll_fd;           // Output pipes of the jobs, or -1 without grouping
+} jobs_t;
+
+/*
+ * Initializes an empty job table. Output is grouped as set by
+ * $SHELL_GROUP_OUTPUT, a comma separated list of "lines" or "blocks" and
+ * optionally "tags".
+ * jobs: Pointer to the table to initialize
+ * Returns 0 on success, 1 on error
+ */
+int jobs_init(jobs_t *jobs);
+
+/*
+ * Releases all memory held by a job table. Jobs still running are left to
+ * run, but grouped output they write after this is lost.
+ * jobs: Pointer to the table to free
+ */
+void jobs_free(jobs_t *jobs);
+
+/*
+ * Start a pipeline in the background and add it to the table. A coprocess
+ * reads its input from the shell and writes its output to the shell, through
+ * pipes that stay open until it ends, so one process can serve many requests.
+ * There is at most one coprocess at a time.
+ * jobs: Pointer to the table
+ * tokens: Vector containing tokens input by user into shell, without the '&'
+ * cache: Pointer to the command cache used to locate programs
+ * exec_cache: Pointer to the cache of open programs
+ * arena: Arena the pipeline is planned in
+ * coproc: If non-zero, the pipeline is started as the coprocess
+ * Returns 0 on success or 1 on error.
+ */
+int jobs_start(jobs_t *jobs, strvec_t *tokens, cmd_cache_t *cache, exec_cache_t *exec_cache, arena_t *arena,
+               int coproc);
+
+/*
+ * Find the coprocess
+ * jobs: Pointer to the table
+ * Returns the job of the coprocess, or NULL if none is running
+ */
+job_t *jobs_coproc(jobs_t *jobs);
+
+/*
+ * Write to the input of a coprocess
+ * job: Pointer to the job of the coprocess
+ * data: Bytes to write
+ * len: Number of bytes
+ * Returns 0 on success, 1 on error, e.g. if its input is closed
+ */
+int jobs_coproc_write(job_t *job, const char *data, size_t len);
+
+/*
+ * Copy lines of the output of a coprocess, waiting for them to be written
+ * job: Pointer to the job of the coprocess
+ * n_lines: Number of lines to copy
+ * fd: Descriptor to copy them to
+ * Returns 0 on success, 1 on error or if the output ends first. A signal
+ * interrupts the wait, with errno set to EINTR.
+ */
+int jobs_coproc_read(job_t *job, unsigned n_lines, int fd);
+
+/*
+ * Close the input of a coprocess, which sees the end of its input
+ * job: Pointer to the job of the coprocess
+ */
+void jobs_coproc_close(job_t *job);
+
+/*
+ * Get a descriptor that becomes readable when jobs have output to print
+ * jobs: Pointer to the table
+ * Returns the descriptor, or -1 without grouped output
+ */
+int jobs_output_fd(const jobs_t *jobs);
+
+/*
+ * Print the grouped output that the jobs have written
+ * jobs: Pointer to the table
+ * timeout: Milliseconds to wait for output if there is none yet, or -1 to
+ *          wait until some job writes or ends
+ * Returns 0 on success, 1 on error
+ */
+int jobs_print_output(jobs_t *jobs, int timeout);
+
+/*
+ * Reap the jobs that have finished, reporting each one that is done
+ * jobs: Pointer to the table
+ */
+void jobs_reap(jobs_t *jobs);
+
+/*
+ * Wait for the jobs with grouped output to finish, printing their output.
+ * Others are left to run.
+ * jobs: Pointer to the table
+ * Returns 0 on success, 1 on error
+ */
+int jobs_finish(jobs_t *jobs);
+
+#endif // JOBS_H
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "io_util.h"
+#include "lastout.h"
+
+#define DEFAULT_SIZE (1 << 20)
+#define CHUNK_SIZE 65536
+
+/*
+ * Read up to 'n' bytes into the free space of the ring, or over its oldest
+ * bytes once it is full. A single read never wraps around the end.
+ * data: Receives where the bytes read start
+ * Returns the number of bytes read, 0 at the end of the input, or -1 on error
+ */
+static ssize_t ring_read(lastout_t *lo, int fd, size_t n, const char **data) {
+    size_t pos = (lo->start + lo->len) % lo->size;
+    if (n > lo->size - pos) {
+        n = lo->size - pos;
+    }
+    ssize_t got;
+    do {
+        got = read(fd, lo->buf + pos, n);
+    } while (got == -1 && errno == EINTR);
+    if (got <= 0) {
+        return got;
+    }
+    *data = lo->buf + pos;
+    lo->len += got;
+    if (lo->len > lo->size) {
+        size_t over = lo->len - lo->size;
+        lo->start = (lo->start + over) % lo->size;
+        lo->len = lo->size;
+        lo->dropped += over;
+    }
+    return got;
+}
+
+int lastout_init(lastout_t *lo) {
+    lo->buf = NULL;
+    lo->size = 0;
+    lo->start = 0;
+    lo->len = 0;
+    lo->dropped = 0;
+
+    const char *value = getenv(LASTOUT_VAR);
+    if (value == NULL) {
+        return 0;
+    }
+    long long size = parse_size(value);
+    lo->size = size > 0 ? size : DEFAULT_SIZE;
+    // Pages are only used once output fills them
+    lo->buf = malloc(lo->size);
+    if (lo->buf == NULL) {
+        lo->size = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void lastout_free(lastout_t *lo) {
+    free(lo->buf);
+    lo->buf = NULL;
+    lo->size = 0;
+}
+
+int lastout_enabled(const lastout_t *lo) {
+    return lo != NULL && lo->buf != NULL;
+}
+
+int lastout_capture(lastout_t *lo, int in_fd, int out_fd) {
+    lo->start = 0;
+    lo->len = 0;
+    lo->dropped = 0;
+
+    struct stat st;
+    int use_tee = fstat(out_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    // After a failed write, the rest is still read so the pipeline can finish
+    int writing = 1;
+    int ret = 0;
+    while (1) {
+        const char *data;
+        if (use_tee && writing) {
+            // The pipe's pages are shared with 'out_fd' rather than copied,
+            // then read into the ring, which consumes them
+            ssize_t n = tee(in_fd, out_fd, CHUNK_SIZE, 0);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n == -1) {
+                if (errno != EINVAL) {
+                    writing = 0;
+                    ret = 1;
+                }
+                use_tee = 0;
+                continue;
+            } else if (n == 0) {
+                break;
+            }
+            while (n > 0) {
+                ssize_t got = ring_read(lo, in_fd, n, &data);
+                if (got <= 0) {
+                    return 1;
+                }
+                n -= got;
+            }
+        } else {
+            ssize_t got = ring_read(lo, in_fd, CHUNK_SIZE, &data);
+            if (got == 0 || (got == -1 && errno == EIO)) {
+                // A pseudo-terminal reports EIO once every writer closed it
+                break;
+            } else if (got == -1) {
+                return 1;
+            }
+            if (writing && write_all(out_fd, data, got, -1) != 0) {
+                writing = 0;
+                ret = 1;
+            }
+        }
+    }
+    return ret;
+}
+
+int lastout_open_pty(int fds[2], int like_fd) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master == -1) {
+        return 1;
+    }
+    char name[64];
+    int slave = -1;
+    if (grantpt(master) == 0 && unlockpt(master) == 0 && ptsname_r(master, name, sizeof(name)) == 0) {
+        slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    }
+    if (slave == -1) {
+        close(master);
+        return 1;
+    }
+
+    struct termios attr;
+    if (tcgetattr(like_fd, &attr) == 0) {
+        attr.c_oflag &= ~OPOST;
+        tcsetattr(slave, TCSANOW, &attr);
+    }
+    struct winsize ws;
+    if (ioctl(like_fd, TIOCGWINSZ, &ws) == 0) {
+        ioctl(slave, TIOCSWINSZ, &ws);
+    }
+    fds[0] = master;
+    fds[1] = slave;
+    return 0;
+}
+
+int lastout_write(const lastout_t *lo, int fd) {
+    // The bytes kept wrap around the end of the ring at most once
+    struct iovec iov[2];
+    size_t first = lo->size - lo->start;
+    if (first > lo->len) {
+        first = lo->len;
+    }
+    iov[0].iov_base = lo->buf + lo->start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = lo->buf;
+    iov[1].iov_len = lo->len - first;
+    return writev_all(fd, iov, 2);
+}
@@ -0,0 +1,76 @@
+#ifndef LASTOUT_H
+#define LASTOUT_H
+
+#include <stddef.h>
+
+// Setting this variable makes the shell keep the end of the output of the
+// last pipeline, for the lastout builtin. Its value may give the number of
+// bytes kept, e.g. "16M".
+#define LASTOUT_VAR "SHELL_LASTOUT"
+
+/*
+ * Ring buffer holding the last bytes a pipeline wrote to the shell's
+ * standard output
+ */
+typedef struct {
+    char *buf;              // NULL unless the output is kept
+    size_t size;
+    size_t start;           // Oldest byte kept
+    size_t len;
+    size_t dropped;         // Bytes of the output that did not fit
+} lastout_t;
+
+/*
+ * Initializes an empty ring buffer, sized as set by $SHELL_LASTOUT. If the
+ * variable is not set, no output is kept.
+ * lo: Pointer to the buffer to initialize
+ * Returns 0 on success, 1 on error
+ */
+int lastout_init(lastout_t *lo);
+
+/*
+ * Releases all memory held by a ring buffer
+ * lo: Pointer to the buffer to free
+ */
+void lastout_free(lastout_t *lo);
+
+/*
+ * Check whether output is kept
+ * lo: Pointer to the buffer, or NULL
+ * Returns 1 if it is, 0 otherwise
+ */
+int lastout_enabled(const lastout_t *lo);
+
+/*
+ * Copy everything read from a pipe or pseudo-terminal to a descriptor,
+ * replacing the contents of the buffer with the end of it. When 'out_fd' is
+ * a pipe, the data is duplicated into it with tee rather than written from
+ * the buffer.
+ * lo: Pointer to the buffer
+ * in_fd: Read end of the pipe, or master side of the pseudo-terminal
+ * out_fd: Descriptor the output goes on to
+ * Returns 0 on success, 1 on error
+ */
+int lastout_capture(lastout_t *lo, int in_fd, int out_fd);
+
+/*
+ * Open a pseudo-terminal for a pipeline's output to be captured through in
+ * place of a pipe, so commands writing to it still see a terminal. It takes
+ * the size and modes of the terminal the output goes on to, except that
+ * output is passed through untranslated, for that terminal to translate.
+ * Like a pipe, it is not resized along with the terminal.
+ * fds: Receives the master side, to read from, then the slave side
+ * like_fd: Terminal the output goes on to
+ * Returns 0 on success, 1 on error
+ */
+int lastout_open_pty(int fds[2], int like_fd);
+
+/*
+ * Write the contents of the buffer
+ * lo: Pointer to the buffer
+ * fd: Descriptor to write to
+ * Returns 0 on success, 1 on error
+ */
+int lastout_write(const lastout_t *lo, int fd);
+
+#endif // LASTOUT_H
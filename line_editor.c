@@ -0,0 +1,1262 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "line_editor.h"
+
+#define INITIAL_SIZE 128
+#define READ_CHUNK 4096
+#define DEFAULT_COLS 80
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+
+// Escape sequence parsing states
+#define ESC_NONE 0
+#define ESC_START 1
+#define ESC_CSI 2
+#define ESC_SS3 3
+
+// Editing keys that arrive as escape sequences
+enum {
+    KEY_LEFT = 256,
+    KEY_RIGHT,
+    KEY_UP,
+    KEY_DOWN,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE,
+    KEY_WORD_LEFT,
+    KEY_WORD_RIGHT,
+    KEY_KILL_WORD_RIGHT,
+    KEY_KILL_WORD_LEFT,
+    KEY_PASTE_START,
+    KEY_PASTE_END,
+};
+
+// Bracketed paste mode makes the terminal wrap pasted text in markers
+#define PASTE_ON "\x1b[?2004h"
+#define PASTE_OFF "\x1b[?2004l"
+#define PASTE_END "\x1b[201~"
+
+// Results of processing a key
+#define LINE_EDITING 0
+#define LINE_DONE 1
+#define LINE_EOF 2
+
+/*
+ * Grow a byte buffer so that it can hold at least 'needed' bytes
+ * Returns 0 on success, 1 on error
+ */
+static int reserve(char **data, size_t *cap, size_t needed) {
+    if (needed <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap == 0 ? INITIAL_SIZE : *cap;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    char *new_data = realloc(*data, new_cap);
+    if (new_data == NULL) {
+        return 1;
+    }
+    *data = new_data;
+    *cap = new_cap;
+    return 0;
+}
+
+static int out_append(line_editor_t *le, const char *s, size_t n) {
+    if (reserve(&le->out, &le->out_cap, le->out_len + n) != 0) {
+        return 1;
+    }
+    memcpy(le->out + le->out_len, s, n);
+    le->out_len += n;
+    return 0;
+}
+
+static int out_flush(line_editor_t *le) {
+    size_t written = 0;
+    while (written < le->out_len) {
+        ssize_t n = write(le->out_fd, le->out + written, le->out_len - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            le->out_len = 0;
+            return 1;
+        }
+        written += n;
+    }
+    le->out_len = 0;
+    return 0;
+}
+
+static void move_cursor(line_editor_t *le, size_t from, size_t to) {
+    char seq[32];
+    if (to < from) {
+        out_append(le, seq, snprintf(seq, sizeof(seq), "\x1b[%zuD", from - to));
+    } else if (to > from) {
+        out_append(le, seq, snprintf(seq, sizeof(seq), "\x1b[%zuC", to - from));
+    }
+}
+
+/*
+ * Number of terminal columns taken by a string, skipping escape sequences
+ * and UTF-8 continuation bytes
+ */
+static size_t display_width(const char *s) {
+    size_t width = 0;
+    while (*s != '\0') {
+        if (*s == KEY_ESC && s[1] == '[') {
+            s += 2;
+            while (*s != '\0' && (*s < 0x40 || *s > 0x7e)) {
+                s++;
+            }
+            if (*s != '\0') {
+                s++;
+            }
+            continue;
+        }
+        if ((*s & 0xc0) != 0x80) {
+            width++;
+        }
+        s++;
+    }
+    return width;
+}
+
+/*
+ * The line is edited a character at a time, where a character is a byte
+ * followed by its UTF-8 continuation bytes, at most three of them so stray
+ * ones cannot make a character arbitrarily long. Each takes one column.
+ */
+#define IS_CONTINUATION(c) (((c) & 0xc0) == 0x80)
+#define MAX_CONTINUATION 3
+
+// Position of the character after the one at 'i'
+static size_t next_char(const char *s, size_t len, size_t i) {
+    if (i < len) {
+        i++;
+    }
+    for (int n = 0; n < MAX_CONTINUATION && i < len && IS_CONTINUATION(s[i]); n++) {
+        i++;
+    }
+    return i;
+}
+
+// Position of the character before 'i'
+static size_t prev_char(const char *s, size_t i) {
+    if (i == 0) {
+        return 0;
+    }
+    i--;
+    for (int n = 0; n < MAX_CONTINUATION && i > 0 && IS_CONTINUATION(s[i]); n++) {
+        i--;
+    }
+    return i;
+}
+
+// Position 'n' characters after 'i', or 'len' if the line ends first
+static size_t skip_chars(const char *s, size_t len, size_t i, size_t n) {
+    while (n-- > 0 && i < len) {
+        i = next_char(s, len, i);
+    }
+    return i;
+}
+
+// Position 'n' characters before 'i', or 0 if the line starts first
+static size_t back_chars(const char *s, size_t i, size_t n) {
+    while (n-- > 0 && i > 0) {
+        i = prev_char(s, i);
+    }
+    return i;
+}
+
+// Number of columns taken by the first 'n' bytes of 's'
+static size_t columns(const char *s, size_t n) {
+    size_t cols = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!IS_CONTINUATION(s[i])) {
+            cols++;
+        }
+    }
+    return cols;
+}
+
+static void set_prompt(line_editor_t *le, const char *prompt) {
+    le->prompt = prompt;
+    le->prompt_width = display_width(prompt);
+    le->prompt_changed = 1;
+}
+
+static void query_columns(line_editor_t *le) {
+    struct winsize ws;
+    if (ioctl(le->out_fd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+        le->cols = DEFAULT_COLS;
+    } else {
+        le->cols = ws.ws_col;
+    }
+}
+
+/*
+ * Write characters along with the escape sequences selecting their
+ * highlighting. A sequence is only written where the class changes, and the
+ * terminal is left in the default rendition.
+ * classes: Class of each character, or NULL if highlighting is disabled
+ */
+static void emit_cells(line_editor_t *le, const char *s, const unsigned char *classes, size_t n) {
+    if (classes == NULL) {
+        out_append(le, s, n);
+        return;
+    }
+    int cur = HL_DEFAULT;
+    size_t run = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (classes[i] != cur) {
+            out_append(le, s + run, i - run);
+            run = i;
+            cur = classes[i];
+            const char *seq = hl_sequence(cur);
+            out_append(le, seq, strlen(seq));
+        }
+    }
+    out_append(le, s + run, n - run);
+    if (cur != HL_DEFAULT) {
+        const char *seq = hl_sequence(HL_DEFAULT);
+        out_append(le, seq, strlen(seq));
+    }
+}
+
+/*
+ * Record that the line changed from position 'from' onwards
+ */
+static void line_changed(line_editor_t *le, size_t from) {
+    if (le->highlight) {
+        hl_invalidate(&le->hl, from);
+    }
+}
+
+/*
+ * Bring the screen up to date with the line being edited. Only the part of
+ * the visible window that differs from what is already on screen is written,
+ * and everything for one refresh is sent with a single write. Lines wider
+ * than the terminal scroll horizontally around the cursor, so the amount of
+ * output is bounded by the terminal width rather than the line length.
+ * Characters count as different if their highlighting class changed.
+ * full: If non-zero, redraw the prompt and the whole window
+ */
+static int refresh(line_editor_t *le, int full) {
+    size_t avail = 1;
+    if (le->cols > le->prompt_width + 1) {
+        avail = le->cols - le->prompt_width - 1;
+    }
+
+    // The window is measured in characters, and only the characters in it
+    // are looked at, so long lines cost no more than short ones
+    if (le->pos < le->offset) {
+        le->offset = le->pos;
+    } else if (skip_chars(le->line, le->pos, le->offset, avail) < le->pos) {
+        le->offset = back_chars(le->line, le->pos, avail);
+    }
+    size_t tail = back_chars(le->line, le->len, avail);
+    if (tail < le->offset) {
+        le->offset = tail;
+    }
+
+    const char *want = le->line + le->offset;
+    size_t want_len = skip_chars(le->line, le->len, le->offset, avail) - le->offset;
+
+    const unsigned char *want_classes = NULL;
+    if (le->highlight) {
+        if (hl_update(&le->hl, le->line, le->len, le->offset + want_len) != 0) {
+            return 1;
+        }
+        want_classes = le->hl.classes + le->offset;
+    }
+
+    size_t col;
+    if (full || le->prompt_changed) {
+        le->prompt_changed = 0;
+        out_append(le, "\r", 1);
+        out_append(le, le->prompt, strlen(le->prompt));
+        emit_cells(le, want, want_classes, want_len);
+        out_append(le, "\x1b[K", 3);
+        col = columns(want, want_len);
+    } else {
+        size_t same = 0;
+        while (same < want_len && same < le->shown_len && want[same] == le->shown[same] &&
+               (want_classes == NULL || want_classes[same] == le->shown_classes[same])) {
+            same++;
+        }
+        // Redraw from the start of a character that only partly matches
+        while (same > 0 && ((same < want_len && IS_CONTINUATION(want[same])) ||
+                            (same < le->shown_len && IS_CONTINUATION(le->shown[same])))) {
+            same--;
+        }
+        col = le->shown_col;
+        if (same < want_len || same < le->shown_len) {
+            move_cursor(le, col, columns(want, same));
+            emit_cells(le, want + same, want_classes == NULL ? NULL : want_classes + same, want_len - same);
+            col = columns(want, want_len);
+            if (col < columns(le->shown, le->shown_len)) {
+                out_append(le, "\x1b[K", 3);
+            }
+        }
+    }
+    move_cursor(le, col, columns(want, le->pos - le->offset));
+
+    if (reserve(&le->shown, &le->shown_cap, want_len) != 0) {
+        return 1;
+    }
+    memcpy(le->shown, want, want_len);
+    if (want_classes != NULL) {
+        if (reserve((char **) &le->shown_classes, &le->shown_classes_cap, want_len) != 0) {
+            return 1;
+        }
+        memcpy(le->shown_classes, want_classes, want_len);
+    }
+    le->shown_len = want_len;
+    le->shown_col = columns(want, le->pos - le->offset);
+
+    return out_flush(le);
+}
+
+static int insert_text(line_editor_t *le, const char *s, size_t n) {
+    if (reserve(&le->line, &le->cap, le->len + n + 1) != 0) {
+        return 1;
+    }
+    line_changed(le, le->pos);
+    memmove(le->line + le->pos + n, le->line + le->pos, le->len - le->pos);
+    memcpy(le->line + le->pos, s, n);
+    le->len += n;
+    le->pos += n;
+    return 0;
+}
+
+/*
+ * Remove the characters in [start, end) from the line
+ * save: If non-zero, the removed text replaces the kill buffer
+ */
+static int delete_range(line_editor_t *le, size_t start, size_t end, int save) {
+    if (start >= end) {
+        return 0;
+    }
+    if (save) {
+        if (reserve(&le->kill, &le->kill_cap, end - start) != 0) {
+            return 1;
+        }
+        memcpy(le->kill, le->line + start, end - start);
+        le->kill_len = end - start;
+    }
+    line_changed(le, start);
+    memmove(le->line + start, le->line + end, le->len - end);
+    le->len -= end - start;
+    if (le->pos > end) {
+        le->pos -= end - start;
+    } else if (le->pos > start) {
+        le->pos = start;
+    }
+    return 0;
+}
+
+static size_t word_start(const line_editor_t *le, size_t i) {
+    while (i > 0 && le->line[i - 1] == ' ') {
+        i--;
+    }
+    while (i > 0 && le->line[i - 1] != ' ') {
+        i--;
+    }
+    return i;
+}
+
+static size_t word_end(const line_editor_t *le, size_t i) {
+    while (i < le->len && le->line[i] == ' ') {
+        i++;
+    }
+    while (i < le->len && le->line[i] != ' ') {
+        i++;
+    }
+    return i;
+}
+
+static int set_line(line_editor_t *le, const char *s, size_t n) {
+    if (reserve(&le->line, &le->cap, n + 1) != 0) {
+        return 1;
+    }
+    line_changed(le, 0);
+    memcpy(le->line, s, n);
+    le->len = n;
+    le->pos = n;
+    return 0;
+}
+
+/*
+ * Move through the history by one entry
+ * dir: -1 to move to an older entry, 1 to move to a newer one
+ */
+static int browse_history(line_editor_t *le, int dir) {
+    if (le->history == NULL) {
+        return 0;
+    }
+    uint64_t n = history_length(le->history);
+    if (!le->browsing) {
+        if (dir > 0) {
+            return 0;
+        }
+        if (reserve(&le->saved, &le->saved_cap, le->len) != 0) {
+            return 1;
+        }
+        memcpy(le->saved, le->line, le->len);
+        le->saved_len = le->len;
+        le->hist_pos = n;
+        le->browsing = 1;
+    }
+
+    // Entries still being written by other shells are skipped
+    uint64_t i = le->hist_pos;
+    const char *entry = NULL;
+    while (entry == NULL) {
+        if (dir < 0) {
+            if (i == 0) {
+                return 0;
+            }
+            i--;
+        } else {
+            i++;
+            if (i >= n) {
+                le->browsing = 0;
+                return set_line(le, le->saved, le->saved_len);
+            }
+        }
+        entry = history_get(le->history, i);
+    }
+    le->hist_pos = i;
+    return set_line(le, entry, strlen(entry));
+}
+
+/*
+ * Print completion candidates in columns below the line being edited. The
+ * prompt and line are drawn again underneath them on the next refresh.
+ */
+static void list_matches(line_editor_t *le, const strvec_t *matches) {
+    size_t width = 0;
+    for (unsigned i = 0; i < matches->length; i++) {
+        size_t len = strlen(strvec_get(matches, i));
+        if (len > width) {
+            width = len;
+        }
+    }
+    width += 2;
+    size_t per_row = le->cols / width > 0 ? le->cols / width : 1;
+    size_t rows = (matches->length + per_row - 1) / per_row;
+
+    out_append(le, "\r\n", 2);
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t col = 0; col < per_row; col++) {
+            size_t i = col * rows + row;
+            if (i >= matches->length) {
+                break;
+            }
+            const char *name = strvec_get(matches, i);
+            size_t len = strlen(name);
+            out_append(le, name, len);
+            if (col + 1 < per_row && i + rows < matches->length) {
+                for (size_t pad = len; pad < width; pad++) {
+                    out_append(le, " ", 1);
+                }
+            }
+        }
+        out_append(le, "\r\n", 2);
+    }
+    le->shown_len = 0;
+    le->shown_col = 0;
+    le->prompt_changed = 1;
+}
+
+/*
+ * Complete the command name under the cursor. A unique match is inserted in
+ * full, otherwise the longest common prefix of the matches is inserted, and a
+ * second Tab lists them.
+ */
+static int complete_word(line_editor_t *le) {
+    if (le->complete == NULL) {
+        return 0;
+    }
+    size_t start = le->pos;
+    while (start > 0 && le->line[start - 1] != ' ') {
+        start--;
+    }
+    // Only the first word of each pipeline stage names a command
+    size_t prev = start;
+    while (prev > 0 && le->line[prev - 1] == ' ') {
+        prev--;
+    }
+    if (prev > 0 && !(le->line[prev - 1] == '|' && (prev == 1 || le->line[prev - 2] == ' '))) {
+        return 0;
+    }
+
+    size_t prefix_len = le->pos - start;
+    char *prefix = strndup(le->line + start, prefix_len);
+    if (prefix == NULL) {
+        return 1;
+    }
+    strvec_t matches;
+    if (strvec_init(&matches) != 0) {
+        free(prefix);
+        return 1;
+    }
+    int ret = le->complete(le->complete_ctx, prefix, &matches);
+    free(prefix);
+
+    if (ret != 0 || matches.length == 0) {
+        out_append(le, "\a", 1);
+    } else if (matches.length == 1) {
+        const char *match = strvec_get(&matches, 0);
+        ret = insert_text(le, match + prefix_len, strlen(match) - prefix_len);
+        if (ret == 0) {
+            ret = insert_text(le, " ", 1);
+        }
+    } else {
+        // Matches are sorted, so the first and last bound the common prefix
+        const char *first = strvec_get(&matches, 0);
+        const char *last = strvec_get(&matches, matches.length - 1);
+        size_t common = 0;
+        while (first[common] != '\0' && first[common] == last[common]) {
+            common++;
+        }
+        if (common > prefix_len) {
+            ret = insert_text(le, first + prefix_len, common - prefix_len);
+        } else if (le->last_key == '\t') {
+            list_matches(le, &matches);
+        } else {
+            out_append(le, "\a", 1);
+        }
+    }
+    strvec_clear(&matches);
+    return ret;
+}
+
+static int start_search(line_editor_t *le) {
+    if (le->history == NULL) {
+        return 0;
+    }
+    if (!le->have_index) {
+        if (hist_index_init(&le->hist_index) != 0) {
+            return 1;
+        }
+        le->have_index = 1;
+    }
+    if (reserve(&le->saved, &le->saved_cap, le->len) != 0 ||
+        reserve(&le->query, &le->query_cap, 1) != 0) {
+        return 1;
+    }
+    memcpy(le->saved, le->line, le->len);
+    le->saved_len = le->len;
+    le->browsing = 0;
+    le->searching = 1;
+    le->query_len = 0;
+    le->query[0] = '\0';
+    le->match = -1;
+    le->failed = 0;
+    return 0;
+}
+
+static void end_search(line_editor_t *le) {
+    le->searching = 0;
+    set_prompt(le, le->user_prompt);
+}
+
+/*
+ * Look for the newest entry older than 'before' matching the query and show
+ * it, along with a prompt describing the search
+ */
+static int update_search(line_editor_t *le, uint64_t before) {
+    if (hist_index_update(&le->hist_index, le->history) != 0) {
+        return 1;
+    }
+    if (le->query_len > 0) {
+        int64_t found = hist_index_search(&le->hist_index, le->history, le->query, before);
+        const char *entry = found >= 0 ? history_get(le->history, found) : NULL;
+        if (entry != NULL) {
+            le->match = found;
+            le->failed = 0;
+            if (set_line(le, entry, strlen(entry)) != 0) {
+                return 1;
+            }
+            le->pos = strstr(entry, le->query) - entry;
+        } else {
+            le->failed = 1;
+        }
+    }
+
+    const char *fmt = le->failed ? "(failed reverse-i-search)`%s': " : "(reverse-i-search)`%s': ";
+    size_t needed = strlen(fmt) + le->query_len + 1;
+    if (reserve(&le->search_prompt, &le->search_prompt_cap, needed) != 0) {
+        return 1;
+    }
+    snprintf(le->search_prompt, le->search_prompt_cap, fmt, le->query);
+    set_prompt(le, le->search_prompt);
+    return 0;
+}
+
+static int handle_key(line_editor_t *le, int key);
+
+/*
+ * Apply one key while a reverse search is in progress. Keys that do not
+ * refine the search end it, keeping the match as the line being edited.
+ */
+static int handle_search_key(line_editor_t *le, int key) {
+    uint64_t newest = history_length(le->history);
+    int ret = 0;
+    switch (key) {
+    case CTRL_KEY('r'):
+        if (le->match >= 0) {
+            ret = update_search(le, le->match);
+        }
+        break;
+    case CTRL_KEY('g'):
+    case CTRL_KEY('c'):
+        end_search(le);
+        ret = set_line(le, le->saved, le->saved_len);
+        break;
+    case CTRL_KEY('h'):
+    case KEY_BACKSPACE:
+        le->query_len = prev_char(le->query, le->query_len);
+        le->query[le->query_len] = '\0';
+        le->match = -1;
+        le->failed = 0;
+        ret = update_search(le, newest);
+        break;
+    default:
+        if (key >= ' ' && key < 256 && key != KEY_BACKSPACE) {
+            if (reserve(&le->query, &le->query_cap, le->query_len + 2) != 0) {
+                return -1;
+            }
+            le->query[le->query_len++] = key;
+            le->query[le->query_len] = '\0';
+            ret = update_search(le, le->match >= 0 ? le->match + 1 : newest);
+        } else {
+            end_search(le);
+            return handle_key(le, key);
+        }
+        break;
+    }
+    return ret == 0 ? LINE_EDITING : -1;
+}
+
+/*
+ * Apply one key to the line being edited
+ * Returns LINE_EDITING, LINE_DONE once the line is complete, LINE_EOF at end
+ * of input, or -1 on error
+ */
+static int handle_key(line_editor_t *le, int key) {
+    int ret = 0;
+    switch (key) {
+    case '\r':
+    case '\n':
+        return LINE_DONE;
+    case CTRL_KEY('d'):
+        if (le->len == 0) {
+            return LINE_EOF;
+        }
+        // Fall through
+    case KEY_DELETE:
+        ret = delete_range(le, le->pos, next_char(le->line, le->len, le->pos), 0);
+        break;
+    case CTRL_KEY('h'):
+    case KEY_BACKSPACE:
+        ret = delete_range(le, prev_char(le->line, le->pos), le->pos, 0);
+        break;
+    case CTRL_KEY('a'):
+    case KEY_HOME:
+        le->pos = 0;
+        break;
+    case CTRL_KEY('e'):
+    case KEY_END:
+        le->pos = le->len;
+        break;
+    case CTRL_KEY('b'):
+    case KEY_LEFT:
+        le->pos = prev_char(le->line, le->pos);
+        break;
+    case CTRL_KEY('f'):
+    case KEY_RIGHT:
+        le->pos = next_char(le->line, le->len, le->pos);
+        break;
+    case CTRL_KEY('p'):
+    case KEY_UP:
+        ret = browse_history(le, -1);
+        break;
+    case CTRL_KEY('n'):
+    case KEY_DOWN:
+        ret = browse_history(le, 1);
+        break;
+    case '\t':
+        ret = complete_word(le);
+        break;
+    case KEY_PASTE_START:
+        le->pasting = 1;
+        le->paste_len = 0;
+        le->paste_pos = 0;
+        break;
+    case KEY_PASTE_END:
+        break;
+    case CTRL_KEY('r'):
+        if (start_search(le) != 0 || update_search(le, history_length(le->history)) != 0) {
+            ret = 1;
+        }
+        break;
+    case KEY_WORD_LEFT:
+        le->pos = word_start(le, le->pos);
+        break;
+    case KEY_WORD_RIGHT:
+        le->pos = word_end(le, le->pos);
+        break;
+    case CTRL_KEY('k'):
+        ret = delete_range(le, le->pos, le->len, 1);
+        break;
+    case CTRL_KEY('u'):
+        ret = delete_range(le, 0, le->pos, 1);
+        break;
+    case CTRL_KEY('w'):
+    case KEY_KILL_WORD_LEFT:
+        ret = delete_range(le, word_start(le, le->pos), le->pos, 1);
+        break;
+    case KEY_KILL_WORD_RIGHT:
+        ret = delete_range(le, le->pos, word_end(le, le->pos), 1);
+        break;
+    case CTRL_KEY('y'):
+        ret = insert_text(le, le->kill, le->kill_len);
+        break;
+    case CTRL_KEY('t'):
+        // Swap the characters before and under the cursor, or the last two
+        // at the end of the line
+        if (le->pos > 0) {
+            size_t mid = le->pos == le->len ? prev_char(le->line, le->pos) : le->pos;
+            size_t start = prev_char(le->line, mid);
+            size_t end = next_char(le->line, le->len, mid);
+            if (start < mid) {
+                char c[MAX_CONTINUATION + 1];
+                size_t n = mid - start;
+                line_changed(le, start);
+                memcpy(c, le->line + start, n);
+                memmove(le->line + start, le->line + mid, end - mid);
+                memcpy(le->line + start + (end - mid), c, n);
+                le->pos = end;
+            }
+        }
+        break;
+    case CTRL_KEY('c'):
+        // Abandon the current line and start over on a fresh one
+        out_append(le, "^C\r\n", 4);
+        line_changed(le, 0);
+        le->len = 0;
+        le->pos = 0;
+        le->offset = 0;
+        le->shown_len = 0;
+        le->shown_col = 0;
+        le->browsing = 0;
+        ret = refresh(le, 1);
+        break;
+    case CTRL_KEY('l'):
+        out_append(le, "\x1b[H\x1b[2J", 7);
+        query_columns(le);
+        ret = refresh(le, 1);
+        break;
+    default:
+        if (key >= ' ' && key < KEY_BACKSPACE) {
+            char c = key;
+            ret = insert_text(le, &c, 1);
+        } else if (key > KEY_BACKSPACE && key < 256) {
+            // Pass UTF-8 and other 8-bit bytes through untouched
+            char c = key;
+            ret = insert_text(le, &c, 1);
+        }
+        break;
+    }
+    return ret == 0 ? LINE_EDITING : -1;
+}
+
+/*
+ * Feed one input byte through the escape sequence decoder
+ * Returns the key it completes, or 0 if more bytes are needed
+ */
+static int decode_byte(line_editor_t *le, unsigned char c) {
+    switch (le->esc_state) {
+    case ESC_START:
+        le->esc_state = ESC_NONE;
+        if (c == '[') {
+            le->esc_state = ESC_CSI;
+            le->esc_param = 0;
+            return 0;
+        } else if (c == 'O') {
+            le->esc_state = ESC_SS3;
+            return 0;
+        } else if (c == 'b') {
+            return KEY_WORD_LEFT;
+        } else if (c == 'f') {
+            return KEY_WORD_RIGHT;
+        } else if (c == 'd') {
+            return KEY_KILL_WORD_RIGHT;
+        } else if (c == KEY_BACKSPACE) {
+            return KEY_KILL_WORD_LEFT;
+        }
+        return 0;
+    case ESC_CSI:
+        if (c >= '0' && c <= '9') {
+            le->esc_param = le->esc_param * 10 + (c - '0');
+            return 0;
+        } else if (c == ';') {
+            le->esc_param = 0;
+            return 0;
+        }
+        le->esc_state = ESC_NONE;
+        switch (c) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        case '~':
+            switch (le->esc_param) {
+            case 1:
+            case 7:
+                return KEY_HOME;
+            case 3:
+                return KEY_DELETE;
+            case 4:
+            case 8:
+                return KEY_END;
+            case 200:
+                return KEY_PASTE_START;
+            case 201:
+                return KEY_PASTE_END;
+            }
+            return 0;
+        }
+        return 0;
+    case ESC_SS3:
+        le->esc_state = ESC_NONE;
+        switch (c) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        }
+        return 0;
+    default:
+        if (c == KEY_ESC) {
+            le->esc_state = ESC_START;
+            return 0;
+        }
+        return c;
+    }
+}
+
+static int enable_raw(line_editor_t *le) {
+    if (tcgetattr(le->in_fd, &le->orig_attr) == -1) {
+        return 1;
+    }
+    struct termios raw = le->orig_attr;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(le->in_fd, TCSADRAIN, &raw) == -1) {
+        return 1;
+    }
+    return 0;
+}
+
+static void disable_raw(line_editor_t *le) {
+    tcsetattr(le->in_fd, TCSADRAIN, &le->orig_attr);
+}
+
+/*
+ * Read a line through stdio, used when input is not a terminal
+ */
+static char *read_canonical(line_editor_t *le, const char *prompt) {
+    printf("%s", prompt);
+    ssize_t n = getline(&le->line, &le->cap, stdin);
+    if (n == -1) {
+        return NULL;
+    }
+    if (n > 0 && le->line[n - 1] == '\n') {
+        n--;
+    }
+    le->line[n] = '\0';
+    le->len = n;
+    return le->line;
+}
+
+int le_init(line_editor_t *le, int in_fd, int out_fd, int allow_raw) {
+    memset(le, 0, sizeof(line_editor_t));
+    le->in_fd = in_fd;
+    le->out_fd = out_fd;
+    le->raw = allow_raw && isatty(in_fd) && isatty(out_fd);
+    le->prompt_fd = -1;
+    le->output_fd = -1;
+    le->cols = DEFAULT_COLS;
+    if (reserve(&le->line, &le->cap, INITIAL_SIZE) != 0) {
+        return 1;
+    }
+    if (le->raw && getenv("NO_COLOR") == NULL) {
+        if (hl_init(&le->hl) != 0) {
+            return 1;
+        }
+        le->highlight = 1;
+    }
+    return 0;
+}
+
+void le_free(line_editor_t *le) {
+    free(le->line);
+    free(le->kill);
+    free(le->shown);
+    free(le->shown_classes);
+    if (le->highlight) {
+        hl_free(&le->hl);
+    }
+    free(le->out);
+    free(le->input);
+    free(le->saved);
+    free(le->paste);
+    free(le->query);
+    free(le->search_prompt);
+    if (le->have_index) {
+        hist_index_free(&le->hist_index);
+    }
+    memset(le, 0, sizeof(line_editor_t));
+}
+
+/*
+ * Insert a completed paste into the line in one step. Line breaks in the
+ * pasted text end the line being edited, and the lines after the first are
+ * kept to be returned by the following calls without any editing.
+ * Returns LINE_EDITING, LINE_DONE if the paste contained a line break, or -1
+ * on error
+ */
+static int finish_paste(line_editor_t *le) {
+    // Normalize line breaks, turn tabs into spaces and drop other controls
+    size_t n = 0;
+    for (size_t i = 0; i < le->paste_len; i++) {
+        char c = le->paste[i];
+        if (c == '\r') {
+            if (i + 1 < le->paste_len && le->paste[i + 1] == '\n') {
+                continue;
+            }
+            c = '\n';
+        } else if (c == '\t') {
+            c = ' ';
+        } else if ((unsigned char) c < ' ' && c != '\n') {
+            continue;
+        }
+        le->paste[n++] = c;
+    }
+    le->paste_len = n;
+
+    char *nl = memchr(le->paste, '\n', le->paste_len);
+    size_t first_len = nl == NULL ? le->paste_len : (size_t) (nl - le->paste);
+    if (insert_text(le, le->paste, first_len) != 0) {
+        return -1;
+    }
+    if (nl == NULL) {
+        le->paste_len = 0;
+        le->paste_pos = 0;
+        return LINE_EDITING;
+    }
+    le->paste_pos = first_len + 1;
+    return LINE_DONE;
+}
+
+/*
+ * Move pasted text from the input buffer to the paste buffer, up to the
+ * paste end marker
+ * Returns the result of finish_paste once the end marker is reached, or
+ * LINE_EDITING if more input is needed
+ */
+static int ingest_paste(line_editor_t *le) {
+    const char *start = le->input + le->input_pos;
+    size_t avail = le->input_len - le->input_pos;
+    size_t marker_len = strlen(PASTE_END);
+    const char *end = memmem(start, avail, PASTE_END, marker_len);
+
+    size_t take = end != NULL ? (size_t) (end - start) : avail;
+    if (end == NULL) {
+        // Hold back a tail that could be the start of a split end marker
+        for (size_t keep = marker_len - 1; keep > 0; keep--) {
+            if (keep <= avail && memcmp(start + avail - keep, PASTE_END, keep) == 0) {
+                take = avail - keep;
+                le->paste_partial = 1;
+                break;
+            }
+        }
+    }
+
+    if (reserve(&le->paste, &le->paste_cap, le->paste_len + take) != 0) {
+        return -1;
+    }
+    memcpy(le->paste + le->paste_len, start, take);
+    le->paste_len += take;
+    le->input_pos += take;
+
+    if (end == NULL) {
+        return LINE_EDITING;
+    }
+    le->input_pos += marker_len;
+    le->pasting = 0;
+    return finish_paste(le);
+}
+
+/*
+ * Take the next line left over from a paste
+ * Returns 1 if a complete line was taken, 0 otherwise. An incomplete last
+ * line is moved into the line being edited.
+ */
+static int take_pasted_line(line_editor_t *le) {
+    if (le->paste_pos >= le->paste_len) {
+        return 0;
+    }
+    const char *start = le->paste + le->paste_pos;
+    size_t remaining = le->paste_len - le->paste_pos;
+    const char *nl = memchr(start, '\n', remaining);
+    size_t len = nl == NULL ? remaining : (size_t) (nl - start);
+    if (set_line(le, start, len) != 0) {
+        le->paste_len = 0;
+        le->paste_pos = 0;
+        return 0;
+    }
+    if (nl == NULL) {
+        le->paste_len = 0;
+        le->paste_pos = 0;
+        return 0;
+    }
+    le->paste_pos += len + 1;
+    return 1;
+}
+
+void le_set_completion(line_editor_t *le, le_complete_fn fn, void *ctx) {
+    le->complete = fn;
+    le->complete_ctx = ctx;
+}
+
+void le_set_prompt_source(line_editor_t *le, int fd, le_prompt_fn fn, void *ctx) {
+    le->prompt_fd = fd;
+    le->prompt_fn = fn;
+    le->prompt_ctx = ctx;
+}
+
+void le_set_output_source(line_editor_t *le, int fd, le_output_fn fn, void *ctx) {
+    le->output_fd = fd;
+    le->output_fn = fn;
+    le->output_ctx = ctx;
+}
+
+/*
+ * Print output from the output source on the line being edited, which is
+ * drawn again below it
+ * Returns 0 on success, 1 on error
+ */
+static int print_output(line_editor_t *le) {
+    // Anything already shown below the cursor row is left as it is
+    out_append(le, "\r\x1b[K", 4);
+    if (out_flush(le) != 0 || le->output_fn(le->output_ctx) != 0) {
+        return 1;
+    }
+    le->shown_len = 0;
+    le->shown_col = 0;
+    le->prompt_changed = 1;
+    return refresh(le, 1);
+}
+
+/*
+ * Wait until keystrokes are available, redrawing the prompt if it is
+ * updated in the meantime and printing output that arrives
+ * Returns 0 once input is available, 1 on error
+ */
+static int wait_for_input(line_editor_t *le) {
+    if (le->prompt_fd == -1 && le->output_fd == -1) {
+        return 0;
+    }
+    // poll() skips the entry of a source that is not set
+    struct pollfd fds[3];
+    fds[0].fd = le->in_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = le->prompt_fd;
+    fds[1].events = POLLIN;
+    fds[2].fd = le->output_fd;
+    fds[2].events = POLLIN;
+    while (1) {
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        fds[2].revents = 0;
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        if ((fds[2].revents & POLLIN) && print_output(le) != 0) {
+            return 1;
+        }
+        if (fds[1].revents & POLLIN) {
+            const char *prompt = le->prompt_fn(le->prompt_ctx);
+            if (prompt != NULL) {
+                int changed = strcmp(prompt, le->user_prompt) != 0;
+                le->user_prompt = prompt;
+                if (!le->searching) {
+                    le->prompt = prompt;
+                    if (changed) {
+                        set_prompt(le, prompt);
+                        if (refresh(le, 1) != 0) {
+                            return 1;
+                        }
+                    }
+                }
+            }
+        }
+        if (fds[0].revents != 0) {
+            return 0;
+        }
+    }
+}
+
+void le_set_history(line_editor_t *le, history_t *hist) {
+    le->history = hist;
+    le->browsing = 0;
+}
+
+/*
+ * Read the keys that are ready into the input buffer. Outside a paste they
+ * are read one byte at a time, stopping after a line break: keys typed ahead
+ * of the line's end belong to the command about to run, and must stay in the
+ * terminal for it to read.
+ * Returns the number of bytes read, 0 at end of input, or -1 on error
+ */
+static ssize_t read_input(line_editor_t *le) {
+    char *buf = le->input + le->input_len;
+    if (le->pasting) {
+        return read(le->in_fd, buf, READ_CHUNK);
+    }
+    ssize_t n = 0;
+    while (n < READ_CHUNK) {
+        ssize_t got = read(le->in_fd, buf + n, 1);
+        if (got <= 0) {
+            return n > 0 ? n : got;
+        }
+        struct pollfd pfd = {le->in_fd, POLLIN, 0};
+        char c = buf[n++];
+        if (c == '\r' || c == '\n' || poll(&pfd, 1, 0) != 1) {
+            break;
+        }
+    }
+    return n;
+}
+
+char *le_readline(line_editor_t *le, const char *prompt) {
+    if (!le->raw) {
+        return read_canonical(le, prompt);
+    }
+
+    fflush(stdout);
+    if (enable_raw(le) != 0) {
+        return read_canonical(le, prompt);
+    }
+
+    line_changed(le, 0);
+    le->len = 0;
+    le->pos = 0;
+    if (take_pasted_line(le)) {
+        // Lines after the first of a paste are shown but not edited
+        le->line[le->len] = '\0';
+        out_append(le, "\r", 1);
+        out_append(le, prompt, strlen(prompt));
+        out_append(le, le->line, le->len);
+        out_append(le, "\x1b[K\r\n", 5);
+        out_flush(le);
+        disable_raw(le);
+        return le->line;
+    }
+
+    le->user_prompt = prompt;
+    set_prompt(le, prompt);
+    le->offset = 0;
+    le->shown_len = 0;
+    le->shown_col = 0;
+    le->esc_state = ESC_NONE;
+    le->browsing = 0;
+    le->searching = 0;
+    le->last_key = 0;
+    query_columns(le);
+
+    le->pasting = 0;
+    out_append(le, PASTE_ON, strlen(PASTE_ON));
+    int status = refresh(le, 1) == 0 ? LINE_EDITING : -1;
+    while (status == LINE_EDITING) {
+        if (le->input_pos == le->input_len || le->paste_partial) {
+            // Keep unprocessed bytes and read more after them
+            memmove(le->input, le->input + le->input_pos, le->input_len - le->input_pos);
+            le->input_len -= le->input_pos;
+            le->input_pos = 0;
+            le->paste_partial = 0;
+            if (reserve(&le->input, &le->input_cap, le->input_len + READ_CHUNK) != 0 ||
+                wait_for_input(le) != 0) {
+                status = -1;
+                break;
+            }
+            ssize_t n = read_input(le);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                status = LINE_EOF;
+                break;
+            }
+            le->input_len += n;
+        }
+
+        // Apply every key already received before redrawing once. Anything
+        // read past the end of a paste stays buffered for the next call.
+        while (status == LINE_EDITING && le->input_pos < le->input_len && !le->paste_partial) {
+            if (le->pasting) {
+                // Pasted text skips key handling and redraws entirely
+                status = ingest_paste(le);
+                continue;
+            }
+            int key = decode_byte(le, le->input[le->input_pos++]);
+            if (key != 0) {
+                status = le->searching ? handle_search_key(le, key) : handle_key(le, key);
+                le->last_key = key;
+            }
+        }
+        if (status == LINE_EDITING && refresh(le, 0) != 0) {
+            status = -1;
+        }
+    }
+
+    if (status == LINE_DONE) {
+        le->pos = le->len;
+        refresh(le, 0);
+    }
+    out_append(le, "\r\n", 2);
+    out_append(le, PASTE_OFF, strlen(PASTE_OFF));
+    out_flush(le);
+    disable_raw(le);
+
+    if (status != LINE_DONE) {
+        return NULL;
+    }
+    le->line[le->len] = '\0';
+    return le->line;
+}
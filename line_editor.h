@@ -0,0 +1,189 @@
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+#include <stddef.h>
+#include <termios.h>
+
+#include "string_vector.h"
+#include "history.h"
+#include "hist_index.h"
+#include "highlight.h"
+
+/*
+ * Completion callback, adding every completion of a command name prefix to
+ * 'matches' in sorted order. Returns 0 on success, 1 on error.
+ */
+typedef int (*le_complete_fn)(void *ctx, const char *prefix, strvec_t *matches);
+
+/*
+ * Prompt callback, returning an up-to-date rendering of the prompt or NULL
+ * on error
+ */
+typedef const char *(*le_prompt_fn)(void *ctx);
+
+/*
+ * Output callback, writing output that arrived from elsewhere to the
+ * terminal. Returns 0 on success, 1 on error
+ */
+typedef int (*le_output_fn)(void *ctx);
+
+typedef struct {
+    int in_fd;
+    int out_fd;
+    int raw;                   // 1 if keystrokes are edited in raw mode
+    struct termios orig_attr;  // Terminal settings to restore after each line
+
+    // Line being edited
+    char *line;
+    size_t len;
+    size_t cap;
+    size_t pos;
+
+    // Text removed by the last kill command, inserted again by yank
+    char *kill;
+    size_t kill_len;
+    size_t kill_cap;
+
+    // Portion of the line currently shown on screen after the prompt
+    char *shown;
+    unsigned char *shown_classes;  // Highlighting class of each shown character
+    size_t shown_len;
+    size_t shown_cap;
+    size_t shown_classes_cap;
+    size_t shown_col;          // Cursor column, relative to the end of the prompt
+    size_t offset;             // Index of the first visible character of 'line'
+    size_t cols;
+
+    const char *prompt;        // Prompt currently shown
+    size_t prompt_width;
+    int prompt_changed;        // Prompt must be redrawn on the next refresh
+    const char *user_prompt;   // Prompt passed to le_readline
+
+    // Syntax highlighting of the line, disabled by $NO_COLOR
+    int highlight;
+    highlighter_t hl;
+
+    // Output for the current keystroke, flushed with a single write
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+
+    // Input read from the terminal but not yet processed
+    char *input;
+    size_t input_len;
+    size_t input_pos;
+    size_t input_cap;
+
+    int esc_state;
+    int esc_param;
+
+    // Text received through bracketed paste. Complete lines left over once
+    // the line being edited ends are returned by the following calls.
+    int pasting;               // 1 between the paste start and end markers
+    int paste_partial;         // Input ends with a possible partial end marker
+    char *paste;
+    size_t paste_len;
+    size_t paste_pos;
+    size_t paste_cap;
+
+    // History browsed with the up and down keys, or NULL if there is none
+    history_t *history;
+    uint64_t hist_pos;         // Entry being shown while browsing
+    int browsing;
+    char *saved;               // Line that was being edited when browsing started
+    size_t saved_len;
+    size_t saved_cap;
+
+    // Incremental reverse search through the history (Ctrl-R)
+    hist_index_t hist_index;   // Built the first time a search starts
+    int have_index;
+    int searching;
+    char *query;
+    size_t query_len;
+    size_t query_cap;
+    int64_t match;             // Entry currently shown, or -1 if none yet
+    int failed;                // 1 if the query has no match
+    char *search_prompt;
+    size_t search_prompt_cap;
+
+    // Command name completion (Tab)
+    le_complete_fn complete;
+    void *complete_ctx;
+    int last_key;
+
+    // Source of prompt updates that arrive while a line is being edited
+    int prompt_fd;
+    le_prompt_fn prompt_fn;
+    void *prompt_ctx;
+
+    // Source of other output to print above the line being edited
+    int output_fd;
+    le_output_fn output_fn;
+    void *output_ctx;
+} line_editor_t;
+
+/*
+ * Initializes a line editor reading from 'in_fd' and drawing on 'out_fd'
+ * le: Pointer to the editor to initialize
+ * in_fd: File descriptor keystrokes are read from
+ * out_fd: File descriptor the prompt and line are drawn on
+ * allow_raw: If non-zero and 'in_fd' is a terminal, lines are edited in raw
+ *            mode. Otherwise lines are read in canonical mode through stdio.
+ * Returns 0 on success, 1 on error
+ */
+int le_init(line_editor_t *le, int in_fd, int out_fd, int allow_raw);
+
+/*
+ * Releases all memory held by a line editor
+ * le: Pointer to the editor to free
+ */
+void le_free(line_editor_t *le);
+
+/*
+ * Attach a history for the editor to browse with the up and down keys
+ * le: Pointer to the editor
+ * hist: History to browse, or NULL to detach the current one
+ */
+void le_set_history(line_editor_t *le, history_t *hist);
+
+/*
+ * Set the callback used to complete command names when Tab is pressed
+ * le: Pointer to the editor
+ * fn: Completion callback, or NULL to disable completion
+ * ctx: Passed as the first argument of every call to 'fn'
+ */
+void le_set_completion(line_editor_t *le, le_complete_fn fn, void *ctx);
+
+/*
+ * Redraw the prompt while a line is being edited whenever 'fd' becomes
+ * readable and 'fn' renders a prompt different from the one shown. 'fn' is
+ * responsible for consuming the data available on 'fd'.
+ * le: Pointer to the editor
+ * fd: File descriptor signalling prompt updates, or -1 to disable updates
+ * fn: Callback rendering the updated prompt
+ * ctx: Passed as the argument of every call to 'fn'
+ */
+void le_set_prompt_source(line_editor_t *le, int fd, le_prompt_fn fn, void *ctx);
+
+/*
+ * Let output be printed while a line is being edited. Whenever 'fd' becomes
+ * readable, the line is cleared, 'fn' writes the output, and the prompt and
+ * line are drawn again below it. 'fn' is responsible for consuming the data
+ * available on 'fd'.
+ * le: Pointer to the editor
+ * fd: File descriptor signalling output, or -1 to disable it
+ * fn: Callback writing the output
+ * ctx: Passed as the argument of every call to 'fn'
+ */
+void le_set_output_source(line_editor_t *le, int fd, le_output_fn fn, void *ctx);
+
+/*
+ * Prints a prompt and reads one line of input from the user
+ * le: Pointer to the editor to read with
+ * prompt: Prompt to print before the line
+ * Returns the line without its trailing newline, or NULL on end of input or
+ * error. The line is owned by the editor and is overwritten by the next call.
+ */
+char *le_readline(line_editor_t *le, const char *prompt);
+
+#endif // LINE_EDITOR_H
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "onchange.h"
+
+// Milliseconds without a change before a run starts
+#define DEBOUNCE_MS 100
+// Milliseconds a cancelled run has to exit before it is killed
+#define CANCEL_GRACE_MS 2000
+
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Signal handlers write to this pipe, so poll wakes up for them
+static int wake_fds[2] = {-1, -1};
+static volatile sig_atomic_t interrupted;
+
+static void on_signal(int sig) {
+    if (sig == SIGINT) {
+        interrupted = 1;
+    }
+    int saved_errno = errno;
+    ssize_t ret = write(wake_fds[1], "", 1);
+    (void) ret;
+    errno = saved_errno;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Watch the paths that are not watched, e.g. because they were replaced
+ * since they were added. Paths that do not exist are tried again later.
+ */
+static void add_watches(int inotify_fd, char **paths, int *wds, unsigned n_paths) {
+    for (unsigned i = 0; i < n_paths; i++) {
+        if (wds[i] == -1) {
+            wds[i] = inotify_add_watch(inotify_fd, paths[i], WATCH_MASK);
+        }
+    }
+}
+
+/*
+ * Read the pending events of an inotify descriptor, forgetting the watches
+ * that ended
+ * Returns 1 if any event is a change, 0 otherwise
+ */
+static int read_events(int inotify_fd, int *wds, unsigned n_paths) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t n;
+    while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            if (event->mask & (IN_IGNORED | IN_MOVE_SELF)) {
+                // A moved path no longer names what is watched. The watch of
+                // a removed one is gone already.
+                for (unsigned i = 0; i < n_paths; i++) {
+                    if (wds[i] == event->wd) {
+                        if (event->mask & IN_MOVE_SELF) {
+                            inotify_rm_watch(inotify_fd, wds[i]);
+                        }
+                        wds[i] = -1;
+                    }
+                }
+            }
+            if (event->mask & WATCH_MASK) {
+                changed = 1;
+            }
+        }
+    }
+    return changed;
+}
+
+int onchange_run(pipeline_t *p, exec_cache_t *exec_cache, char **paths, unsigned n_paths) {
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("onchange: inotify_init1");
+        return 1;
+    }
+    int wds[n_paths];
+    for (unsigned i = 0; i < n_paths; i++) {
+        if ((wds[i] = inotify_add_watch(inotify_fd, paths[i], WATCH_MASK)) == -1) {
+            fprintf(stderr, "onchange: %s: %s\n", paths[i], strerror(errno));
+            close(inotify_fd);
+            return 1;
+        }
+    }
+    if (pipe2(wake_fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("onchange: pipe");
+        close(inotify_fd);
+        return 1;
+    }
+
+    // Ctrl-C stops the run and then onchange, not the shell, and the end of a
+    // run wakes the loop up like a change does
+    struct sigaction action, old_int, old_chld;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    interrupted = 0;
+    sigaction(SIGINT, &action, &old_int);
+    sigaction(SIGCHLD, &action, &old_chld);
+
+    // Each run gets a process group of its own, so cancelling it reaches the
+    // processes its commands started as well, e.g. the compilers under make.
+    // Being out of the terminal's foreground group, it reads /dev/null.
+    p->background = 1;
+
+    // The first run starts right away
+    int ret = 0;
+    int pending = 1;
+    long long run_at = now_ms();
+    int running = 0;
+    long long kill_at = -1;  // When a cancelled run is killed, or -1
+    while (!interrupted) {
+        if (running && reap_pipeline(p)) {
+            running = 0;
+            kill_at = -1;
+        }
+        long long now = now_ms();
+        if (kill_at != -1 && now >= kill_at) {
+            signal_pipeline(p, SIGKILL);
+            kill_at = -1;
+        }
+        if (pending && !running && now >= run_at) {
+            pending = 0;
+            // Replaced files are watched again before the run reads them
+            add_watches(inotify_fd, paths, wds, n_paths);
+            if (start_pipeline(p, exec_cache, 0) != 0) {
+                ret = 1;
+                break;
+            }
+            running = 1;
+            continue;
+        }
+
+        int timeout = -1;
+        if (pending && !running) {
+            timeout = run_at - now;
+        }
+        if (kill_at != -1 && (timeout == -1 || kill_at - now < timeout)) {
+            timeout = kill_at - now;
+        }
+        struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {wake_fds[0], POLLIN, 0}};
+        if (poll(fds, 2, timeout) == -1 && errno != EINTR) {
+            perror("onchange: poll");
+            ret = 1;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(wake_fds[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+        if ((fds[0].revents & POLLIN) && read_events(inotify_fd, wds, n_paths)) {
+            // Each change pushes the run back, and cancels the current one
+            pending = 1;
+            run_at = now_ms() + DEBOUNCE_MS;
+            if (running && kill_at == -1) {
+                signal_pipeline(p, SIGTERM);
+                kill_at = now_ms() + CANCEL_GRACE_MS;
+            }
+        }
+    }
+
+    // Ctrl-C only reached onchange, the run being in a group of its own
+    if (running) {
+        signal_pipeline(p, SIGINT);
+        wait_pipeline(p);
+    }
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGCHLD, &old_chld, NULL);
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    wake_fds[0] = wake_fds[1] = -1;
+    close(inotify_fd);
+    return ret;
+}
@@ -0,0 +1,23 @@
+#ifndef ONCHANGE_H
+#define ONCHANGE_H
+
+#include "exec_cache.h"
+#include "shell_funcs.h"
+
+/*
+ * Run a planned pipeline, then run it again each time one of 'paths'
+ * changes, until interrupted with Ctrl-C. Changes are watched with inotify:
+ * a file changes when it is written, replaced or removed, a directory when
+ * an entry in it does. Changes are gathered until none has come for a short
+ * while, so saving many files at once causes one run. A change during a run
+ * stops that run, and every process it started, before the next one starts.
+ * Each run has a process group of its own and reads /dev/null.
+ * p: Pointer to the pipeline
+ * exec_cache: Pointer to the cache of open programs
+ * paths: Files and directories to watch
+ * n_paths: Number of paths
+ * Returns 0 on success, 1 on error
+ */
+int onchange_run(pipeline_t *p, exec_cache_t *exec_cache, char **paths, unsigned n_paths);
+
+#endif // ONCHANGE_H
@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "prompt.h"
+
+#define PLACEHOLDER "..."
+#define INITIAL_SIZE 128
+#define GIT_OUTPUT_LEN 4096
+
+extern char **environ;
+
+// Seconds a background value stays fresh, by segment
+static const int segment_ttl[NUM_SEGMENTS] = {
+    [SEGMENT_GIT] = 3,
+    [SEGMENT_LOAD] = 10,
+    [SEGMENT_K8S] = 30,
+};
+
+// Whether a value only applies to the directory it was computed in
+static const int segment_per_dir[NUM_SEGMENTS] = {
+    [SEGMENT_GIT] = 1,
+};
+
+struct worker_args {
+    prompt_t *p;
+    int segment;
+    char cwd[PATH_MAX];
+};
+
+/*
+ * Compute the branch and work tree state of the repository containing 'cwd'
+ * with a single 'git status' run
+ */
+static void compute_git(const char *cwd, char *value) {
+    value[0] = '\0';
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        return;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    char *argv[] = {"git", "-C", (char *) cwd, "status", "--porcelain", "--branch", NULL};
+    pid_t pid;
+    int err = posix_spawnp(&pid, "git", &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipe_fds[1]);
+    if (err != 0) {
+        close(pipe_fds[0]);
+        return;
+    }
+
+    char out[GIT_OUTPUT_LEN];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(pipe_fds[0], out + len, sizeof(out) - 1 - len)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        len += n;
+        if (len == sizeof(out) - 1) {
+            // Only the first lines matter, discard the rest
+            char discard[GIT_OUTPUT_LEN];
+            while (read(pipe_fds[0], discard, sizeof(discard)) > 0) {
+            }
+            break;
+        }
+    }
+    close(pipe_fds[0]);
+    out[len] = '\0';
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return;
+    }
+
+    // The first line is "## <branch>[...<upstream>]", every other line is a change
+    if (strncmp(out, "## ", 3) != 0) {
+        return;
+    }
+    char *branch = out + 3;
+    char *eol = strchr(branch, '\n');
+    int dirty = eol != NULL && eol[1] != '\0';
+    if (eol != NULL) {
+        *eol = '\0';
+    }
+    const char *no_commits = "No commits yet on ";
+    if (strncmp(branch, no_commits, strlen(no_commits)) == 0) {
+        branch += strlen(no_commits);
+    }
+    char *upstream = strstr(branch, "...");
+    if (upstream != NULL) {
+        *upstream = '\0';
+    }
+    snprintf(value, SEGMENT_LEN, "%s%s", branch, dirty ? "*" : "");
+}
+
+static void compute_load(char *value) {
+    value[0] = '\0';
+    FILE *f = fopen("/proc/loadavg", "re");
+    if (f == NULL) {
+        return;
+    }
+    if (fscanf(f, "%127s", value) != 1) {
+        value[0] = '\0';
+    }
+    fclose(f);
+}
+
+static void compute_k8s(char *value) {
+    value[0] = '\0';
+    char path[PATH_MAX];
+    const char *kubeconfig = getenv("KUBECONFIG");
+    const char *home = getenv("HOME");
+    if (kubeconfig != NULL && kubeconfig[0] != '\0') {
+        // Only the first file of a list can set the current context
+        size_t len = strcspn(kubeconfig, ":");
+        snprintf(path, sizeof(path), "%.*s", (int) len, kubeconfig);
+    } else if (home != NULL) {
+        snprintf(path, sizeof(path), "%s/.kube/config", home);
+    } else {
+        return;
+    }
+
+    FILE *f = fopen(path, "re");
+    if (f == NULL) {
+        return;
+    }
+    char line[1024];
+    const char *key = "current-context:";
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, key, strlen(key)) == 0) {
+            char *start = line + strlen(key);
+            start += strspn(start, " \t\"'");
+            size_t len = strcspn(start, " \t\"'\r\n");
+            snprintf(value, SEGMENT_LEN, "%.*s", (int) len, start);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static void *worker(void *arg) {
+    struct worker_args *args = arg;
+    prompt_segment_t *seg = &args->p->segments[args->segment];
+    char value[SEGMENT_LEN];
+
+    switch (args->segment) {
+    case SEGMENT_GIT:
+        compute_git(args->cwd, value);
+        break;
+    case SEGMENT_LOAD:
+        compute_load(value);
+        break;
+    case SEGMENT_K8S:
+        compute_k8s(value);
+        break;
+    }
+
+    pthread_mutex_lock(&seg->lock);
+    memcpy(seg->value, value, sizeof(value));
+    memcpy(seg->cwd, args->cwd, sizeof(args->cwd));
+    clock_gettime(CLOCK_MONOTONIC, &seg->computed);
+    seg->valid = 1;
+    seg->running = 0;
+    pthread_mutex_unlock(&seg->lock);
+
+    // A full pipe already guarantees a wakeup, so a failed write is harmless
+    char c = 0;
+    ssize_t ignored = write(args->p->notify_fds[1], &c, 1);
+    (void) ignored;
+    free(args);
+    return NULL;
+}
+
+/*
+ * Start a worker for a segment if its value is missing or stale
+ * Must be called with the segment's lock held
+ */
+static void maybe_start_worker(prompt_t *p, int segment, const char *cwd) {
+    prompt_segment_t *seg = &p->segments[segment];
+    if (seg->running) {
+        return;
+    }
+    if (seg->valid) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int fresh = now.tv_sec - seg->computed.tv_sec < segment_ttl[segment];
+        if (fresh && (!segment_per_dir[segment] || strcmp(seg->cwd, cwd) == 0)) {
+            return;
+        }
+    }
+
+    struct worker_args *args = malloc(sizeof(struct worker_args));
+    if (args == NULL) {
+        return;
+    }
+    args->p = p;
+    args->segment = segment;
+    snprintf(args->cwd, sizeof(args->cwd), "%s", cwd);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, worker, args) == 0) {
+        seg->running = 1;
+    } else {
+        free(args);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static int append(prompt_t *p, size_t *len, const char *s, size_t n) {
+    char **buf = &p->bufs[p->cur];
+    size_t *cap = &p->caps[p->cur];
+    if (*len + n + 1 > *cap) {
+        size_t new_cap = *cap == 0 ? INITIAL_SIZE : *cap;
+        while (*len + n + 1 > new_cap) {
+            new_cap *= 2;
+        }
+        char *new_buf = realloc(*buf, new_cap);
+        if (new_buf == NULL) {
+            return 1;
+        }
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+    return 0;
+}
+
+static int append_segment(prompt_t *p, size_t *len, int segment, const char *cwd) {
+    prompt_segment_t *seg = &p->segments[segment];
+    char value[SEGMENT_LEN];
+
+    pthread_mutex_lock(&seg->lock);
+    maybe_start_worker(p, segment, cwd);
+    if (seg->valid && (!segment_per_dir[segment] || strcmp(seg->cwd, cwd) == 0)) {
+        memcpy(value, seg->value, sizeof(value));
+    } else {
+        strcpy(value, PLACEHOLDER);
+    }
+    pthread_mutex_unlock(&seg->lock);
+
+    return append(p, len, value, strlen(value));
+}
+
+int prompt_init(prompt_t *p, const char *format) {
+    memset(p, 0, sizeof(prompt_t));
+    p->notify_fds[0] = -1;
+    p->notify_fds[1] = -1;
+    for (int i = 0; i < NUM_SEGMENTS; i++) {
+        pthread_mutex_init(&p->segments[i].lock, NULL);
+    }
+    p->format = strdup(format);
+    if (p->format == NULL) {
+        return 1;
+    }
+    if (pipe2(p->notify_fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        free(p->format);
+        p->format = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void prompt_free(prompt_t *p) {
+    int running = 0;
+    for (int i = 0; i < NUM_SEGMENTS; i++) {
+        pthread_mutex_lock(&p->segments[i].lock);
+        running |= p->segments[i].running;
+        pthread_mutex_unlock(&p->segments[i].lock);
+    }
+    // Workers still running will write to the notification pipe
+    if (!running) {
+        if (p->notify_fds[0] != -1) {
+            close(p->notify_fds[0]);
+        }
+        if (p->notify_fds[1] != -1) {
+            close(p->notify_fds[1]);
+        }
+    }
+    free(p->format);
+    free(p->bufs[0]);
+    free(p->bufs[1]);
+    p->format = NULL;
+    p->bufs[0] = NULL;
+    p->bufs[1] = NULL;
+}
+
+const char *prompt_render(prompt_t *p) {
+    // Drain wakeups, this render picks up every value available so far
+    char drain[64];
+    while (read(p->notify_fds[0], drain, sizeof(drain)) > 0) {
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        strcpy(cwd, "?");
+    }
+
+    p->cur = !p->cur;
+    size_t len = 0;
+    if (append(p, &len, "", 0) != 0) {
+        return NULL;
+    }
+    for (const char *f = p->format; *f != '\0'; f++) {
+        int ret = 0;
+        if (*f != '%' || f[1] == '\0') {
+            ret = append(p, &len, f, 1);
+            if (ret != 0) {
+                return NULL;
+            }
+            continue;
+        }
+        f++;
+        switch (*f) {
+        case 'u': {
+            const char *user = getenv("USER");
+            if (user == NULL) {
+                struct passwd *pw = getpwuid(getuid());
+                user = pw != NULL ? pw->pw_name : "?";
+            }
+            ret = append(p, &len, user, strlen(user));
+            break;
+        }
+        case 'h': {
+            char host[256];
+            if (gethostname(host, sizeof(host)) == -1) {
+                strcpy(host, "?");
+            }
+            host[sizeof(host) - 1] = '\0';
+            ret = append(p, &len, host, strcspn(host, "."));
+            break;
+        }
+        case 'w': {
+            const char *home = getenv("HOME");
+            size_t home_len = home != NULL ? strlen(home) : 0;
+            if (home_len > 1 && strncmp(cwd, home, home_len) == 0 &&
+                (cwd[home_len] == '/' || cwd[home_len] == '\0')) {
+                ret = append(p, &len, "~", 1);
+                if (ret == 0) {
+                    ret = append(p, &len, cwd + home_len, strlen(cwd + home_len));
+                }
+            } else {
+                ret = append(p, &len, cwd, strlen(cwd));
+            }
+            break;
+        }
+        case 'W': {
+            const char *base = strrchr(cwd, '/');
+            base = base != NULL && base[1] != '\0' ? base + 1 : cwd;
+            ret = append(p, &len, base, strlen(base));
+            break;
+        }
+        case 'g':
+            ret = append_segment(p, &len, SEGMENT_GIT, cwd);
+            break;
+        case 'l':
+            ret = append_segment(p, &len, SEGMENT_LOAD, cwd);
+            break;
+        case 'k':
+            ret = append_segment(p, &len, SEGMENT_K8S, cwd);
+            break;
+        case 'e':
+            ret = append(p, &len, "\x1b", 1);
+            break;
+        default:
+            // Unknown sequences, including "%%", stand for the character after the '%'
+            ret = append(p, &len, f, 1);
+            break;
+        }
+        if (ret != 0) {
+            return NULL;
+        }
+    }
+    return p->bufs[p->cur];
+}
+
+int prompt_notify_fd(const prompt_t *p) {
+    return p->notify_fds[0];
+}
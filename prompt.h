@@ -0,0 +1,82 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+
+// Prompt segments that are computed in the background
+#define SEGMENT_GIT 0
+#define SEGMENT_LOAD 1
+#define SEGMENT_K8S 2
+#define NUM_SEGMENTS 3
+
+#define SEGMENT_LEN 128
+
+typedef struct {
+    pthread_mutex_t lock;
+    int running;                // 1 while a worker is computing the value
+    int valid;                  // 1 once a value has been computed
+    char value[SEGMENT_LEN];
+    char cwd[PATH_MAX];         // Directory the value was computed in
+    struct timespec computed;   // When the value was computed
+} prompt_segment_t;
+
+/*
+ * A customizable prompt. The format is copied to the prompt with these
+ * substitutions:
+ *   %u  user name           %h  host name (up to the first '.')
+ *   %w  working directory   %W  last component of the working directory
+ *   %g  git branch, followed by '*' if the work tree has changes
+ *   %l  one-minute load average
+ *   %k  current kubernetes context
+ *   %e  escape character, for terminal color sequences
+ *   %%  a literal '%'
+ * The git, load and kubernetes segments are computed by background threads.
+ * Rendering never waits for them: it uses the last value computed (or "..."
+ * if there is none yet for the working directory) and starts a worker when
+ * that value is missing or too old. When a worker finishes, a byte is
+ * written to the notification descriptor so the prompt can be redrawn.
+ */
+typedef struct {
+    char *format;
+    prompt_segment_t segments[NUM_SEGMENTS];
+    int notify_fds[2];
+    char *bufs[2];              // Rendered prompts, alternated between renders
+    size_t caps[2];
+    int cur;
+} prompt_t;
+
+/*
+ * Initializes a prompt
+ * p: Pointer to the prompt to initialize
+ * format: Format of the prompt, as described above
+ * Returns 0 on success, 1 on error
+ */
+int prompt_init(prompt_t *p, const char *format);
+
+/*
+ * Releases the resources held by a prompt. Workers still running are left
+ * to finish on their own and must not outlive the process.
+ * p: Pointer to the prompt to free
+ */
+void prompt_free(prompt_t *p);
+
+/*
+ * Render a prompt with the values currently available
+ * p: Pointer to the prompt
+ * Returns the rendered prompt, valid until the next call after this one, or
+ * NULL on error
+ */
+const char *prompt_render(prompt_t *p);
+
+/*
+ * Determine the file descriptor that becomes readable when a background
+ * segment has a new value
+ * p: Pointer to the prompt
+ * Returns the file descriptor
+ */
+int prompt_notify_fd(const prompt_t *p);
+
+#endif // PROMPT_H
@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "redirect.h"
+
+// A redirection token, e.g. "2>&1" or "&>>" followed by its file
+struct redir_op {
+    int fd;            // Descriptor redirected
+    int both;          // 1 for &> and &>>, which redirect 1 and 2
+    int flags;         // Flags to open the file with
+    int is_dup;        // 1 for >&m and <&m
+    int dup_fd;        // m, or -1 for >&- and <&-
+    const char *rest;  // The file, if it is in the same token
+};
+
+/*
+ * Read a descriptor number from the characters before 'end'
+ * Returns the number, or -1 if 'p' does not start with one; the number is
+ * REDIR_MAX_FD if it is too large
+ */
+static int parse_fd(const char **p, const char *end) {
+    if (*p == end || **p < '0' || **p > '9') {
+        return -1;
+    }
+    int fd = 0;
+    for (; *p < end && **p >= '0' && **p <= '9'; (*p)++) {
+        fd = fd * 10 + (**p - '0');
+        if (fd > REDIR_MAX_FD) {
+            fd = REDIR_MAX_FD;
+        }
+    }
+    return fd;
+}
+
+// The character at 'p', or '\0' at 'end'
+static char peek(const char *p, const char *end) {
+    return p < end ? *p : '\0';
+}
+
+/*
+ * Recognize a redirection token, made of the characters before 'end'
+ * Returns 1 if it is one, with 'op' filled in, 0 if it is not, and -1 if it
+ * is malformed
+ */
+static int parse_op(const char *token, const char *end, struct redir_op *op) {
+    const char *p = token;
+    op->both = 0;
+    op->is_dup = 0;
+    op->fd = parse_fd(&p, end);
+    if (op->fd == -1 && peek(p, end) == '&' && peek(p + 1, end) == '>') {
+        op->both = 1;
+        p++;
+    }
+    if (peek(p, end) != '<' && peek(p, end) != '>') {
+        return 0;
+    }
+
+    int default_fd;
+    int single = 0;
+    if (p[0] == '<' && peek(p + 1, end) == '>') {
+        op->flags = O_RDWR | O_CREAT;
+        default_fd = 0;
+        p += 2;
+    } else if (p[0] == '>' && peek(p + 1, end) == '>') {
+        op->flags = O_WRONLY | O_CREAT | O_APPEND;
+        default_fd = 1;
+        p += 2;
+    } else if (p[0] == '<') {
+        op->flags = O_RDONLY;
+        default_fd = 0;
+        single = 1;
+        p++;
+    } else {
+        op->flags = O_WRONLY | O_CREAT | O_TRUNC;
+        default_fd = 1;
+        single = 1;
+        p++;
+    }
+    if (op->both && op->flags == O_RDWR) {
+        return -1;
+    }
+    if (op->fd == -1) {
+        op->fd = default_fd;
+    }
+
+    if (peek(p, end) == '&') {
+        if (!single || op->both) {
+            return -1;
+        }
+        p++;
+        op->is_dup = 1;
+        if (peek(p, end) == '-' && p + 1 == end) {
+            op->dup_fd = -1;
+            p++;
+        } else if ((op->dup_fd = parse_fd(&p, end)) == -1 || p != end) {
+            return -1;
+        }
+    }
+    op->rest = p;
+    return 1;
+}
+
+int redir_recognize(const char *word, size_t len, size_t *op_len) {
+    struct redir_op op;
+    int ret = parse_op(word, word + len, &op);
+    if (ret != 1) {
+        return ret;
+    }
+    *op_len = op.rest - word;
+    return op.is_dup ? 2 : 1;
+}
+
+int redir_parse(const strvec_t *tokens, arena_t *arena, redir_plan_t *plan) {
+    plan->args = arena_alloc(arena, (tokens->length + 1) * sizeof(char *));
+    plan->files = arena_alloc(arena, tokens->length * sizeof(redir_file_t));
+    if (plan->args == NULL || (tokens->length > 0 && plan->files == NULL)) {
+        fprintf(stderr, "redirect: Out of memory\n");
+        return 1;
+    }
+    plan->argc = 0;
+    plan->n_files = 0;
+    for (int fd = 0; fd < REDIR_MAX_FD; fd++) {
+        plan->fds[fd].kind = REDIR_ORIGINAL;
+        plan->fds[fd].index = fd;
+    }
+
+    for (unsigned i = 0; i < tokens->length; i++) {
+        char *token = strvec_get(tokens, i);
+        struct redir_op op;
+        int ret = parse_op(token, token + strlen(token), &op);
+        if (ret == 0) {
+            plan->args[plan->argc++] = token;
+            continue;
+        }
+        if (ret == -1) {
+            fprintf(stderr, "redirect: Syntax error near '%s'\n", token);
+            return 1;
+        }
+        if (op.fd >= REDIR_MAX_FD || (op.is_dup && op.dup_fd >= REDIR_MAX_FD)) {
+            fprintf(stderr, "redirect: %s: Only descriptors 0 to %d can be redirected\n", token, REDIR_MAX_FD - 1);
+            return 1;
+        }
+
+        redir_source_t source;
+        if (op.is_dup) {
+            // The descriptor takes whatever 'dup_fd' refers to at this point
+            if (op.dup_fd == -1) {
+                source.kind = REDIR_CLOSED;
+                source.index = 0;
+            } else {
+                source = plan->fds[op.dup_fd];
+            }
+        } else {
+            const char *path = op.rest;
+            if (*path == '\0') {
+                const char *next = strvec_get(tokens, i + 1);
+                size_t next_len;
+                if (next == NULL || redir_recognize(next, strlen(next), &next_len) != 0) {
+                    fprintf(stderr, "redirect: Expected a file after '%s'\n", token);
+                    return 1;
+                }
+                path = strvec_get(tokens, ++i);
+            }
+            if (plan->n_files > UCHAR_MAX) {
+                fprintf(stderr, "redirect: Too many redirections\n");
+                return 1;
+            }
+            plan->files[plan->n_files].path = path;
+            plan->files[plan->n_files].flags = op.flags;
+            source.kind = REDIR_FILE;
+            source.index = plan->n_files++;
+        }
+        plan->fds[op.fd] = source;
+        if (op.both) {
+            plan->fds[2] = source;
+        }
+    }
+    plan->args[plan->argc] = NULL;
+    return 0;
+}
+
+int redir_take_output(redir_plan_t *plan, redir_file_t *file) {
+    redir_source_t out = plan->fds[1];
+    if (out.kind != REDIR_FILE || (plan->files[out.index].flags & O_ACCMODE) == O_RDONLY) {
+        return 1;
+    }
+    *file = plan->files[out.index];
+    plan->files[out.index].path = NULL;
+    for (int fd = 0; fd < REDIR_MAX_FD; fd++) {
+        if (plan->fds[fd].kind == REDIR_FILE && plan->fds[fd].index == out.index) {
+            plan->fds[fd].kind = REDIR_ORIGINAL;
+            plan->fds[fd].index = 1;
+        }
+    }
+    return 0;
+}
+
+// Working directory files are opened relative to, if set
+static const dirs_t *redir_dirs;
+
+void redir_set_dirs(const dirs_t *dirs) {
+    redir_dirs = dirs;
+}
+
+int redir_open(const char *path, int flags) {
+    if (redir_dirs != NULL) {
+        return dirs_open(redir_dirs, path, flags, 0600);
+    }
+    return open(path, flags, 0600);
+}
+
+static int is_changed(const redir_plan_t *plan, int fd) {
+    return plan->fds[fd].kind != REDIR_ORIGINAL || plan->fds[fd].index != fd;
+}
+
+int redir_apply(const redir_plan_t *plan) {
+    // Files are opened above the descriptors being redirected, so no
+    // redirection replaces one before it is used
+    int file_fds[plan->n_files + 1];
+    for (unsigned i = 0; i < plan->n_files; i++) {
+        if (plan->files[i].path == NULL) {
+            file_fds[i] = -1;
+            continue;
+        }
+        int fd = redir_open(plan->files[i].path, plan->files[i].flags | O_CLOEXEC);
+        if (fd != -1 && fd < REDIR_MAX_FD) {
+            int moved = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_MAX_FD);
+            close(fd);
+            fd = moved;
+        }
+        if (fd == -1) {
+            fprintf(stderr, "%s: %s\n", plan->files[i].path, strerror(errno));
+            for (unsigned j = 0; j < i; j++) {
+                if (file_fds[j] != -1) {
+                    close(file_fds[j]);
+                }
+            }
+            return 1;
+        }
+        file_fds[i] = fd;
+    }
+
+    // A descriptor that is replaced but is also the source of another, as in
+    // "3>&1 1>&2 2>&3", is copied out of the way first
+    int saved[REDIR_MAX_FD];
+    for (int fd = 0; fd < REDIR_MAX_FD; fd++) {
+        saved[fd] = -1;
+        if (!is_changed(plan, fd)) {
+            continue;
+        }
+        for (int other = 0; other < REDIR_MAX_FD; other++) {
+            if (other != fd && plan->fds[other].kind == REDIR_ORIGINAL && plan->fds[other].index == fd) {
+                // A descriptor that is not open is reported by dup2 below
+                saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_MAX_FD);
+                break;
+            }
+        }
+    }
+
+    int ret = 0;
+    for (int fd = 0; fd < REDIR_MAX_FD && ret == 0; fd++) {
+        if (!is_changed(plan, fd)) {
+            continue;
+        }
+        redir_source_t source = plan->fds[fd];
+        if (source.kind == REDIR_CLOSED) {
+            close(fd);
+        } else if (source.kind == REDIR_FILE) {
+            if (dup2(file_fds[source.index], fd) == -1) {
+                perror("dup2");
+                ret = 1;
+            }
+        } else {
+            int from = saved[source.index] != -1 ? saved[source.index] : source.index;
+            if (dup2(from, fd) == -1) {
+                fprintf(stderr, "%d: %s\n", source.index, strerror(errno));
+                ret = 1;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < plan->n_files; i++) {
+        if (file_fds[i] != -1) {
+            close(file_fds[i]);
+        }
+    }
+    for (int fd = 0; fd < REDIR_MAX_FD; fd++) {
+        if (saved[fd] != -1) {
+            close(saved[fd]);
+        }
+    }
+    return ret;
+}
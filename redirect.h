@@ -0,0 +1,110 @@
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include "arena.h"
+#include "dirs.h"
+#include "string_vector.h"
+
+// Redirections apply to descriptors 0 to REDIR_MAX_FD - 1. Descriptors the
+// shell moves out of the way while applying them are at or above it.
+#define REDIR_MAX_FD 10
+
+// What a descriptor refers to once a plan is applied
+enum redir_source_kind {
+    REDIR_ORIGINAL,  // The descriptor 'index' had before the plan was applied
+    REDIR_FILE,      // File 'index' of the plan
+    REDIR_CLOSED,
+};
+
+typedef struct {
+    unsigned char kind;
+    unsigned char index;
+} redir_source_t;
+
+// A file to open for a plan
+typedef struct {
+    const char *path;  // NULL once the file is taken by redir_take_output()
+    int flags;
+} redir_file_t;
+
+/*
+ * The arguments and redirections of one command. Redirections are not kept
+ * as the list the user wrote but as their net effect: the files to open and
+ * the final source of each descriptor. Applying a plan opens each file once
+ * and then changes only the descriptors whose source differs from their own,
+ * so e.g. "> a 2>&1 > b 1>&1" opens 'a' and 'b' (creating or truncating them
+ * as written) and then makes two dup2 calls.
+ */
+typedef struct {
+    char **args;                          // NULL-terminated
+    unsigned argc;
+    redir_file_t *files;
+    unsigned n_files;
+    redir_source_t fds[REDIR_MAX_FD];
+} redir_plan_t;
+
+/*
+ * Build the plan of a command from its tokens. Redirections may appear
+ * anywhere among the arguments, with or without a space before their file:
+ *   [n]< file    [n]> file    [n]>> file    [n]<> file
+ *   &> file      &>> file     [n]>&m        [n]<&m        [n]>&-    [n]<&-
+ * Syntax errors are reported on stderr.
+ * tokens: Tokens of the command
+ * arena: Arena the plan is allocated from
+ * plan: Receives the plan, which refers to the strings of 'tokens'
+ * Returns 0 on success, 1 on error
+ */
+int redir_parse(const strvec_t *tokens, arena_t *arena, redir_plan_t *plan);
+
+/*
+ * Recognize a redirection at the start of a word the way redir_parse() does,
+ * e.g. to highlight it
+ * word: The word, which need not be NUL-terminated
+ * len: Length of the word
+ * op_len: Receives the length of the operator. The rest of the word is the
+ *         file of a redirection to or from a file; if the rest is empty, the
+ *         next word is.
+ * Returns 1 for a redirection to or from a file, 2 for one that duplicates or
+ * closes a descriptor, 0 if the word is not a redirection, and -1 if it is
+ * malformed
+ */
+int redir_recognize(const char *word, size_t len, size_t *op_len);
+
+/*
+ * Take the file standard output is redirected to out of a plan, so the
+ * caller can write it from what the command writes to its standard output.
+ * The file is then not opened by the plan, and descriptors that referred to
+ * it refer to standard output instead.
+ * plan: Pointer to the plan
+ * file: Receives the file and the flags to open it with
+ * Returns 0 if standard output was redirected to a file for writing, 1 if
+ * not, in which case the plan is unchanged
+ */
+int redir_take_output(redir_plan_t *plan, redir_file_t *file);
+
+/*
+ * Open the files of redirections relative to the working directory held open
+ * by 'dirs', so their relative paths are resolved from its descriptor
+ * dirs: Pointer to the directory state, which must outlive its use here, or
+ *       NULL to open files relative to the process's working directory
+ */
+void redir_set_dirs(const dirs_t *dirs);
+
+/*
+ * Open the file of a redirection, relative to the directory set with
+ * redir_set_dirs
+ * path: Path of the file
+ * flags: As for open
+ * Returns the file descriptor on success, -1 on error
+ */
+int redir_open(const char *path, int flags);
+
+/*
+ * Apply the redirections of a plan to the calling process, typically a child
+ * about to exec. Errors are reported on stderr.
+ * plan: Pointer to the plan
+ * Returns 0 on success, 1 on error
+ */
+int redir_apply(const redir_plan_t *plan);
+
+#endif // REDIRECT_H
@@ -0,0 +1,212 @@
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shared_cache.h"
+
+#define NUM_ENTRIES 4096
+#define PROBE_LIMIT 16
+#define ENTRY_NAME_LEN 64
+#define ENTRY_PATH_LEN 168
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+struct shared_entry {
+    _Atomic uint32_t seq;       // Odd while the entry is being written
+    uint32_t dir;               // Index in $PATH of the directory containing the command
+    _Atomic uint64_t key;       // Hash of $PATH and the name, 0 for a free entry
+    uint64_t signature;         // Hash of the mtimes of the directories up to 'dir'
+    char name[ENTRY_NAME_LEN];
+    char path[ENTRY_PATH_LEN];
+};
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t hash_key(const char *path_value, const char *name) {
+    uint64_t h = hash_bytes(FNV_OFFSET, path_value, strlen(path_value) + 1);
+    h = hash_bytes(h, name, strlen(name));
+    // 0 marks free entries
+    return h == 0 ? 1 : h;
+}
+
+static uint64_t hash_mtime(uint64_t h, const struct timespec *mtime) {
+    int64_t fields[2] = {mtime->tv_sec, mtime->tv_nsec};
+    return hash_bytes(h, fields, sizeof(fields));
+}
+
+/*
+ * Copy an entry, following the sequence number protocol
+ * Returns 0 if the copy is consistent, 1 if the entry was being written
+ */
+static int read_entry(struct shared_entry *e, struct shared_entry *copy) {
+    uint32_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+    if (seq & 1) {
+        return 1;
+    }
+    copy->dir = e->dir;
+    copy->key = atomic_load_explicit(&e->key, memory_order_relaxed);
+    copy->signature = e->signature;
+    memcpy(copy->name, e->name, ENTRY_NAME_LEN);
+    memcpy(copy->path, e->path, ENTRY_PATH_LEN);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&e->seq, memory_order_relaxed) != seq) {
+        return 1;
+    }
+    // A torn copy is caught above, but be safe against a corrupt object
+    copy->name[ENTRY_NAME_LEN - 1] = '\0';
+    copy->path[ENTRY_PATH_LEN - 1] = '\0';
+    return 0;
+}
+
+/*
+ * Check that the directories of $PATH up to the one an entry refers to have
+ * not changed since the entry was written
+ * Returns 1 if the entry is valid, 0 otherwise
+ */
+static int validate(const struct shared_entry *e, const char *path_value) {
+    uint64_t signature = FNV_OFFSET;
+    const char *start = path_value;
+    for (uint32_t i = 0; i <= e->dir; i++) {
+        const char *end = strchr(start, ':');
+        size_t len = end == NULL ? strlen(start) : (size_t) (end - start);
+        char dir[ENTRY_PATH_LEN];
+        if (len == 0 || start[0] != '/' || len >= sizeof(dir)) {
+            return 0;
+        }
+        memcpy(dir, start, len);
+        dir[len] = '\0';
+
+        struct stat st;
+        struct timespec missing = {-1, 0};
+        signature = hash_mtime(signature, stat(dir, &st) == 0 ? &st.st_mtim : &missing);
+
+        if (i == e->dir) {
+            // The path must still be this directory and the name, in case
+            // two values of $PATH hash alike
+            if (strncmp(e->path, dir, len) != 0 || e->path[len] != '/' ||
+                strcmp(e->path + len + 1, e->name) != 0) {
+                return 0;
+            }
+        } else if (end == NULL) {
+            return 0;
+        }
+        start = end + 1;
+    }
+    return signature == e->signature;
+}
+
+int shared_cache_open(shared_cache_t *sc, const char *name) {
+    memset(sc, 0, sizeof(shared_cache_t));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+        close(fd);
+        return 1;
+    }
+    size_t size = NUM_ENTRIES * sizeof(struct shared_entry);
+    // Shells racing to create the object all extend it to the same size,
+    // and a new object is all free entries
+    if (st.st_size < size && ftruncate(fd, size) == -1) {
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+    sc->entries = map;
+    sc->size = size;
+    return 0;
+}
+
+void shared_cache_close(shared_cache_t *sc) {
+    if (sc->entries != NULL) {
+        munmap(sc->entries, sc->size);
+    }
+    memset(sc, 0, sizeof(shared_cache_t));
+}
+
+int shared_cache_lookup(shared_cache_t *sc, const char *path_value, const char *name, char *buf, size_t size) {
+    uint64_t key = hash_key(path_value, name);
+    for (unsigned i = 0; i < PROBE_LIMIT; i++) {
+        struct shared_entry *e = &sc->entries[(key + i) % NUM_ENTRIES];
+        uint64_t k = atomic_load_explicit(&e->key, memory_order_relaxed);
+        if (k == 0) {
+            return 1;
+        }
+        struct shared_entry copy;
+        if (k != key || read_entry(e, &copy) != 0 || copy.key != key || strcmp(copy.name, name) != 0) {
+            continue;
+        }
+        if (!validate(&copy, path_value) || strlen(copy.path) >= size) {
+            return 1;
+        }
+        strcpy(buf, copy.path);
+        return 0;
+    }
+    return 1;
+}
+
+void shared_cache_store(shared_cache_t *sc, const char *path_value, const char *name,
+                        const char *const *dirs, const struct timespec *mtimes, unsigned n_dirs) {
+    if (n_dirs == 0 || strlen(name) >= ENTRY_NAME_LEN) {
+        return;
+    }
+    uint64_t signature = FNV_OFFSET;
+    for (unsigned i = 0; i < n_dirs; i++) {
+        // Relative directories resolve differently in every working directory
+        if (dirs[i][0] != '/') {
+            return;
+        }
+        signature = hash_mtime(signature, &mtimes[i]);
+    }
+    char path[ENTRY_PATH_LEN];
+    if (snprintf(path, sizeof(path), "%s/%s", dirs[n_dirs - 1], name) >= sizeof(path)) {
+        return;
+    }
+
+    // Reuse the entry for the same command, else take the first free entry,
+    // else evict the first entry probed
+    uint64_t key = hash_key(path_value, name);
+    struct shared_entry *target = &sc->entries[key % NUM_ENTRIES];
+    for (unsigned i = 0; i < PROBE_LIMIT; i++) {
+        struct shared_entry *e = &sc->entries[(key + i) % NUM_ENTRIES];
+        uint64_t k = atomic_load_explicit(&e->key, memory_order_relaxed);
+        struct shared_entry copy;
+        if (k == 0 || (k == key && read_entry(e, &copy) == 0 && strcmp(copy.name, name) == 0)) {
+            target = e;
+            break;
+        }
+    }
+
+    // Another shell writing the same entry wins; this is only a cache
+    uint32_t seq = atomic_load_explicit(&target->seq, memory_order_relaxed);
+    if ((seq & 1) || !atomic_compare_exchange_strong(&target->seq, &seq, seq + 1)) {
+        return;
+    }
+    target->dir = n_dirs - 1;
+    target->signature = signature;
+    memset(target->name, 0, ENTRY_NAME_LEN);
+    strcpy(target->name, name);
+    memset(target->path, 0, ENTRY_PATH_LEN);
+    strcpy(target->path, path);
+    atomic_store_explicit(&target->key, key, memory_order_relaxed);
+    atomic_store_explicit(&target->seq, seq + 2, memory_order_release);
+}
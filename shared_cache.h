@@ -0,0 +1,63 @@
+#ifndef SHARED_CACHE_H
+#define SHARED_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+
+struct shared_entry;
+
+/*
+ * Cache of command resolutions shared by every shell of the same user on the
+ * host, kept in a POSIX shared memory object. The cache is an open addressing
+ * hash table keyed by the value of $PATH and the command name. It has no
+ * lock: each entry has a sequence number that is odd while the entry is
+ * being written, and readers discard any entry whose sequence number changed
+ * while they copied it. An entry records the modification times of the $PATH
+ * directories up to the one the command was found in, and is only used if
+ * none of them changed since.
+ */
+typedef struct {
+    struct shared_entry *entries;
+    size_t size;
+} shared_cache_t;
+
+/*
+ * Opens a shared cache, creating it if no shell has yet. Objects not owned
+ * by the user or accessible to others are refused.
+ * sc: Pointer to the cache to initialize
+ * name: Name of the shared memory object, starting with '/'
+ * Returns 0 on success, 1 on error
+ */
+int shared_cache_open(shared_cache_t *sc, const char *name);
+
+/*
+ * Unmaps a shared cache. The shared memory object stays for other shells.
+ * sc: Pointer to the cache to close
+ */
+void shared_cache_close(shared_cache_t *sc);
+
+/*
+ * Find a valid resolution of a command
+ * sc: Pointer to the cache
+ * path_value: Value of $PATH
+ * name: Name of the command
+ * buf: Buffer in which to store the full path of the command
+ * size: Size of 'buf'
+ * Returns 0 if a valid resolution was found, 1 otherwise
+ */
+int shared_cache_lookup(shared_cache_t *sc, const char *path_value, const char *name, char *buf, size_t size);
+
+/*
+ * Record the resolution of a command. Resolutions that depend on the working
+ * directory, or are too long to fit in an entry, are not recorded.
+ * sc: Pointer to the cache
+ * path_value: Value of $PATH
+ * name: Name of the command
+ * dirs: The directories of $PATH, up to and including the one containing the command
+ * mtimes: Modification times of those directories, with -1 seconds for missing ones
+ * n_dirs: Number of elements of 'dirs' and 'mtimes'
+ */
+void shared_cache_store(shared_cache_t *sc, const char *path_value, const char *name,
+                        const char *const *dirs, const struct timespec *mtimes, unsigned n_dirs);
+
+#endif // SHARED_CACHE_H
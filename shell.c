@@ -1,15 +1,55 @@
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "arena.h"
 #include "string_vector.h"
 #include "shell_funcs.h"
+#include "line_editor.h"
+#include "history.h"
+#include "cmd_cache.h"
+#include "shared_cache.h"
+#include "exec_cache.h"
+#include "prompt.h"
+#include "dirs.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "redirect.h"
 
-#define CMD_LEN 512
 #define PROMPT "@> "
+#define HISTORY_FILE ".shell_history"
+#define FRECENCY_FILE ".shell_z"
+#define SHARED_CACHE_NAME "/shell-cmd-cache"
+#define CMD_ARENA_SIZE 4096
+
+static int complete_command(void *ctx, const char *prefix, strvec_t *matches)
+{
+    if (cmd_cache_complete((cmd_cache_t *) ctx, prefix, matches) != 0 || builtin_complete(prefix, matches) != 0)
+    {
+        return 1;
+    }
+    // Builtins come after the programs, and some (e.g. watch) are programs too
+    if (strvec_sort(matches) != 0)
+    {
+        return 1;
+    }
+    strvec_dedupe(matches);
+    return 0;
+}
+
+static const char *render_prompt(void *ctx)
+{
+    return prompt_render((prompt_t *) ctx);
+}
+
+static int print_job_output(void *ctx)
+{
+    return jobs_print_output((jobs_t *) ctx, 0);
+}
 
 int main(int argc, char **argv)
 {
@@ -19,43 +59,237 @@ int main(int argc, char **argv)
         echo = 1;
     }
 
+    // Command lines are searched for these tokens, which are then found by ID
+    if (strvec_intern("|") != 0 || strvec_intern("--") != 0)
+    {
+        printf("Failed to allocate memory\n");
+        return 1;
+    }
+
+    // Everything built while running one line comes from this arena, which
+    // is reset for the next line, so lines allocate nothing once it is big
+    // enough for them
+    arena_t cmd_arena;
+    if (arena_init(&cmd_arena, CMD_ARENA_SIZE) != 0)
+    {
+        printf("Failed to allocate memory\n");
+        return 1;
+    }
     strvec_t tokens;
-    strvec_init(&tokens);
-    char cmd[CMD_LEN];
 
-    printf("%s", PROMPT);
-    while (fgets(cmd, CMD_LEN, stdin) != NULL)
+    // Scripted sessions (--echo) keep reading whole lines in canonical mode
+    line_editor_t editor;
+    if (le_init(&editor, STDIN_FILENO, STDOUT_FILENO, !echo) != 0)
     {
+        printf("Failed to initialize line editor\n");
+        arena_free(&cmd_arena);
+        return 1;
+    }
+
+    // History is only kept for interactive sessions, read from a terminal:
+    // commands piped or redirected in are not the user's. $SHELL_HISTFILE
+    // overrides the default location in the home directory.
+    int interactive = !echo && isatty(STDIN_FILENO);
+    history_t history;
+    int have_history = 0;
+    if (interactive)
+    {
+        char history_path[4096];
+        const char *histfile = getenv("SHELL_HISTFILE");
+        const char *home = getenv("HOME");
+        if (histfile != NULL)
+        {
+            snprintf(history_path, sizeof(history_path), "%s", histfile);
+        }
+        else
+        {
+            snprintf(history_path, sizeof(history_path), "%s/%s", home != NULL ? home : ".", HISTORY_FILE);
+        }
+        if (history_open(&history, history_path) == 0)
+        {
+            have_history = 1;
+            le_set_history(&editor, &history);
+        }
+    }
+
+    // The $PATH cache is only filled in the first time it is needed
+    cmd_cache_t cmd_cache;
+    cmd_cache_init(&cmd_cache);
+
+    // Setting $SHELL_SHARED_CACHE shares command resolutions with the user's
+    // other shells. The cache is simply not used if it cannot be opened.
+    shared_cache_t shared_cache;
+    int have_shared_cache = 0;
+    if (getenv("SHELL_SHARED_CACHE") != NULL)
+    {
+        char shm_name[64];
+        snprintf(shm_name, sizeof(shm_name), "%s.%u", SHARED_CACHE_NAME, (unsigned) geteuid());
+        if (shared_cache_open(&shared_cache, shm_name) == 0)
+        {
+            have_shared_cache = 1;
+            cmd_cache_set_shared(&cmd_cache, &shared_cache);
+        }
+    }
+    le_set_completion(&editor, complete_command, &cmd_cache);
+
+    // Interactive sessions can customize the prompt with $SHELL_PROMPT
+    const char *prompt_format = getenv("SHELL_PROMPT");
+    if (echo || prompt_format == NULL)
+    {
+        prompt_format = PROMPT;
+    }
+    prompt_t prompt;
+    if (prompt_init(&prompt, prompt_format) != 0)
+    {
+        printf("Failed to initialize prompt\n");
+        arena_free(&cmd_arena);
+        le_free(&editor);
+        cmd_cache_free(&cmd_cache);
+        if (have_shared_cache)
+        {
+            shared_cache_close(&shared_cache);
+        }
+        if (have_history)
+        {
+            history_close(&history);
+        }
+        return 1;
+    }
+    le_set_prompt_source(&editor, prompt_notify_fd(&prompt), render_prompt, &prompt);
+
+    // Like history, the database of visited directories ('z') is only kept
+    // for interactive sessions read from a terminal. $SHELL_ZFILE overrides
+    // its location.
+    char frecency_path[4096];
+    const char *zfile = getenv("SHELL_ZFILE");
+    const char *home = getenv("HOME");
+    if (zfile != NULL)
+    {
+        snprintf(frecency_path, sizeof(frecency_path), "%s", zfile);
+    }
+    else
+    {
+        snprintf(frecency_path, sizeof(frecency_path), "%s/%s", home != NULL ? home : ".", FRECENCY_FILE);
+    }
+    dirs_t dirs;
+    if (dirs_init(&dirs, interactive ? frecency_path : NULL) != 0)
+    {
+        perror("Failed to open working directory");
+        arena_free(&cmd_arena);
+        le_free(&editor);
+        cmd_cache_free(&cmd_cache);
+        if (have_shared_cache)
+        {
+            shared_cache_close(&shared_cache);
+        }
+        prompt_free(&prompt);
+        if (have_history)
+        {
+            history_close(&history);
+        }
+        return 1;
+    }
+    // Redirections open their files relative to the cached working directory
+    redir_set_dirs(&dirs);
+
+    // Programs run recently are kept open to be executed by descriptor
+    exec_cache_t exec_cache;
+    exec_cache_init(&exec_cache);
+
+    // Setting $SHELL_LASTOUT keeps the end of each pipeline's output, to be
+    // printed again with lastout
+    lastout_t lastout;
+    if (lastout_init(&lastout) != 0)
+    {
+        printf("Failed to allocate output buffer\n");
+    }
+
+    // Setting $SHELL_GROUP_OUTPUT makes the shell print the output of
+    // background jobs, a whole line or job at a time, even while a line is
+    // being edited
+    jobs_t jobs;
+    jobs_init(&jobs);
+    if (jobs_output_fd(&jobs) != -1)
+    {
+        le_set_output_source(&editor, jobs_output_fd(&jobs), print_job_output, &jobs);
+    }
+
+    builtin_ctx_t builtin_ctx = { &dirs, &cmd_cache, &exec_cache, &cmd_arena, &lastout, &jobs };
+
+    int ret = 0;
+    char *cmd;
+    const char *prompt_str;
+    while (1)
+    {
+        // Jobs are reported before the prompt, so reports never land in the
+        // middle of a foreground command's output
+        jobs_print_output(&jobs, 0);
+        jobs_reap(&jobs);
+        if ((prompt_str = prompt_render(&prompt)) == NULL ||
+            (cmd = le_readline(&editor, prompt_str)) == NULL)
+        {
+            break;
+        }
+
         if (echo)
         {
-            printf("%s", cmd);
+            printf("%s\n", cmd);
         }
-        // Need to remove trailing '\n' from cmd. There are fancier ways.
-        int i = 0;
-        while (cmd[i] != '\n')
+        if (have_history)
         {
-            i++;
+            history_add(&history, cmd);
         }
-        cmd[i] = '\0';
 
-        if (tokenize(cmd, &tokens) != 0)
+        arena_reset(&cmd_arena);
+
+        // Tokens are separated by single spaces, so counting them up front lets
+        // the vector be allocated once at the right size. They keep an argv
+        // array, so pipeline stages can be executed directly.
+        unsigned n_tokens = 1;
+        for (const char *c = cmd; *c != '\0'; c++)
+        {
+            if (*c == ' ')
+            {
+                n_tokens++;
+            }
+        }
+        if (strvec_init_arena(&tokens, &cmd_arena, n_tokens, 1) != 0 || tokenize(cmd, &tokens) != 0)
         {
             printf("Failed to parse command\n");
-            strvec_clear(&tokens);
-            return 1;
+            ret = 1;
+            break;
         }
         if (tokens.length == 0)
         {
-            printf("%s", PROMPT);
             continue;
         }
 
-        if (strcmp(strvec_get(&tokens, 0), "exit") == 0)
+        // A trailing '&' runs the line in the background
+        int background = strcmp(strvec_get(&tokens, tokens.length - 1), "&") == 0;
+        if (background)
+        {
+            strvec_take(&tokens, tokens.length - 1);
+            if (tokens.length == 0)
+            {
+                continue;
+            }
+        }
+
+        if (background)
+        {
+            jobs_start(&jobs, &tokens, &cmd_cache, &exec_cache, &cmd_arena, 0);
+        }
+
+        else if (strcmp(strvec_get(&tokens, 0), "exit") == 0)
         {
-            strvec_clear(&tokens);
             break;
         }
 
+        else if (run_builtin(&builtin_ctx, &tokens) != NOT_BUILTIN)
+        {
+            // Builtins run in the shell process itself
+        }
+
         else if (strvec_find(&tokens, "|") == -1)
         {
             printf("Error: This simplified version of shell only supports piped commands\n");
@@ -64,12 +298,27 @@ int main(int argc, char **argv)
         else
         {
             // Assume this is a pipeline of programs to run
-            run_pipelined_commands(&tokens);
+            run_pipelined_commands(&tokens, &cmd_cache, &exec_cache, &cmd_arena, &lastout);
         }
-
-        strvec_clear(&tokens);
-        printf("%s", PROMPT);
     }
 
-    return 0;
+    // Jobs whose output the shell prints are given the chance to finish it
+    jobs_finish(&jobs);
+    jobs_free(&jobs);
+    le_free(&editor);
+    cmd_cache_free(&cmd_cache);
+    if (have_shared_cache)
+    {
+        shared_cache_close(&shared_cache);
+    }
+    prompt_free(&prompt);
+    dirs_free(&dirs);
+    exec_cache_free(&exec_cache);
+    lastout_free(&lastout);
+    arena_free(&cmd_arena);
+    if (have_history)
+    {
+        history_close(&history);
+    }
+    return ret;
 }
@@ -1,4 +1,9 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -7,6 +12,9 @@
 #include <string.h>
 
 #include "string_vector.h"
+#include "redirect.h"
+#include "bulk_output.h"
+#include "lastout.h"
 #include "shell_funcs.h"
 
 #define MAX_ARGS 10
@@ -28,11 +36,35 @@ int close_all(int *fds, int n) {
     return ret_val;
 }
 
+int exec_command(const redir_plan_t *plan, const char *path, int fd) {
+    if (redir_apply(plan) != 0){
+        return 1;
+    }
+
+    char **args = plan->args;
+    if (plan->argc == 0){
+        fprintf(stderr, "exec: Empty command\n");
+        return 1;
+    }
+    //Executing the open descriptor skips resolving the path again. Scripts
+    //fail with ENOENT, as their interpreter cannot reopen a close-on-exec
+    //descriptor, so they fall back to being executed by path.
+    if (fd != -1){
+        execveat(fd, "", args, environ, AT_EMPTY_PATH);
+    }
+    if (path != NULL){
+        execv(path, args);
+    }
+    //The cached location may have gone stale, so search $PATH before giving up.
+    execvp(args[0], args);
+    perror("exec");
+    return 1;
+}
+
 /*
- * Helper function to run a single command within a pipeline. You should make
- * make use of the provided 'run_command' function here.
- * tokens: String vector containing the tokens representing the command to be
- * executed, possible redirection, and the command's arguments.
+ * Helper function to run a single command within a pipeline, by connecting
+ * it to its pipes and executing it with 'exec_command'.
+ * plan: Arguments and redirections of the command to be executed
  * pipes: An array of pipe file descriptors.
  * n_pipes: Length of the 'pipes' array
  * in_idx: Index of the file descriptor in the array from which the program
@@ -40,9 +72,11 @@ int close_all(int *fds, int n) {
  * out_idx: Index of the file descriptor int he array to which the program
  *          should write its output, or -1 if output should not be written to
  *          a pipe.
+ * path: Location of the program, or NULL to search $PATH for it
+ * fd: Open descriptor of the program, or -1
  * Returns 0 on success or 1 on error.
  */
-int run_piped_command(strvec_t *tokens, int *pipes, int n_pipes, int in_idx, int out_idx) { 
+int run_piped_command(const redir_plan_t *plan, int *pipes, int n_pipes, int in_idx, int out_idx, const char *path, int fd) { 
     if (in_idx != -1){ //If not first command
         if (dup2(pipes[in_idx], STDIN_FILENO) == -1){
             perror("dup2");
@@ -70,7 +104,7 @@ int run_piped_command(strvec_t *tokens, int *pipes, int n_pipes, int in_idx, int
     }
 
     
-    if (run_command(tokens) == 1){
+    if (exec_command(plan, path, fd) == 1){
         fprintf(stderr, "Error run_command\n");
         return 1;
     }
@@ -78,188 +112,277 @@ int run_piped_command(strvec_t *tokens, int *pipes, int n_pipes, int in_idx, int
     return 0; //Not reachable
 }
 
-int run_pipelined_commands(strvec_t *tokens) {
-    
-    int num_pipes = strvec_num_occurrences(tokens, "|"); //No error checking possible
-    int ncommands = num_pipes + 1;
-
-    //Allocate space to store 1 vector per command, 
-    //so vectors can be passed into run_pipelined_command() then run_command() one by one.
-    strvec_t *sliced_tokens = malloc(sizeof(strvec_t)*ncommands); 
-    if (sliced_tokens == NULL){
-        fprintf(stderr, "Error malloc'ing\n");
+int plan_pipeline(strvec_t *tokens, cmd_cache_t *cache, arena_t *arena, pipeline_t *p) {
+
+    //Each command is a view of its part of 'tokens', so nothing is copied and
+    //there is nothing to free in the children. The tables live in the arena,
+    //which the caller resets once the line is done.
+    strvec_t *commands;
+    unsigned n;
+    if (strvec_split_on(tokens, "|", arena, &commands, &n) != 0){
+        fprintf(stderr, "Error strvec_split_on\n");
         return 1;
     }
-    
-    //Make copy of tokens. cur_tokens will be truncated/reduced from left to right as more pipe symbols are found
-    strvec_t cur_tokens;
-    if (strvec_slice(tokens, &cur_tokens, 0, tokens->length) == 1){
-        fprintf(stderr, "Error strvec_slice\n");
-        free(sliced_tokens);
+    p->ncommands = n;
+
+    //Redirections are parsed before anything is started, so a syntax error in
+    //any stage runs nothing.
+    p->plans = arena_alloc(arena, n * sizeof(redir_plan_t));
+    p->paths = arena_alloc(arena, n * sizeof(char *));
+    //n-1 pipes for n commands, and one more for their output if it is captured.
+    p->pipe_fds = arena_alloc(arena, 2*n * sizeof(int));
+    //Children are waited for by pid, so processes the shell starts for other purposes are not reaped here.
+    p->pids = arena_alloc(arena, n * sizeof(pid_t));
+    if (p->plans == NULL || p->paths == NULL || p->pipe_fds == NULL || p->pids == NULL){
+        fprintf(stderr, "Error arena_alloc\n");
         return 1;
     }
-
-    //Truncation doesn't work using strvec_slice (by passing in same vector as src and destintion),
-    //solution was to calculate running offset into tokens, then copying from tokens using an accumulating starting idx (position after pipe).
-    int pipe_token_idx = 0;
-    int start_idx = 0;
-
-    //Calculates where target vectors (portions removed through truncation) will be stored for later use.
-    int n_added_commands = 0;
-
-    //keep slicing tokens until no more pipes, store sliced versions in sliced_tokens.
-    while ((pipe_token_idx = strvec_find(&cur_tokens, "|")) != -1){ 
-        
-        //Target vector
-        if (strvec_slice(&cur_tokens, sliced_tokens+n_added_commands, 0, pipe_token_idx) == 1){
-            fprintf(stderr, "Error strvec_slice\n");
-            free(sliced_tokens);
+    p->n_started = 0;
+    p->out_fd = -1;
+    p->in_fd = -1;
+    p->background = 0;
+    p->pgid = 0;
+
+    for (int i = 0; i < p->ncommands; i++){
+        if (redir_parse(commands+i, arena, p->plans+i) != 0){
             return 1;
         }
-        
-        n_added_commands++;
-
-        start_idx += pipe_token_idx+1;
 
-        //Truncation (removing target vector)   
-        if (strvec_slice(tokens, &cur_tokens, start_idx, tokens->length) == 1){
-            fprintf(stderr, "Error strvec_slice\n");
-            free(sliced_tokens);
-            return 1;
+        //Locate the programs in the parent, so the lookup is cached for later commands.
+        char resolved[PATH_MAX];
+        const char *name = p->plans[i].args[0];
+        p->paths[i] = NULL;
+        if (name != NULL && cmd_cache_resolve(cache, name, resolved, sizeof(resolved)) == 0){
+            size_t len = strlen(resolved) + 1;
+            char *copy = arena_alloc(arena, len);
+            if (copy != NULL){
+                memcpy(copy, resolved, len);
+                p->paths[i] = copy;
+            }
         }
-    
     }
-    
-    //Final target vector after all pipe symbols are removed.
-    if (strvec_slice(&cur_tokens, sliced_tokens+n_added_commands, 0, cur_tokens.length) == 1){
-        fprintf(stderr, "Error strvec_slice\n");
-        free(sliced_tokens);
-        return 1;
-    }
-    n_added_commands++;
-
-
-    //At this point, sliced_tokens array has all commands needed to be run in order
+    return 0;
+}
 
-    //n-1 pipes for n commands.
-    int pipe_fds[2*num_pipes];
+int start_pipeline(pipeline_t *p, exec_cache_t *exec_cache, int capture) {
+    int *pipe_fds = p->pipe_fds;
+    int ncommands = p->ncommands;
+    int n_pipes = ncommands-1 + (capture != 0);
+    p->n_started = 0;
+    p->out_fd = -1;
+    p->pgid = 0;
 
     for (int i = 0; i < ncommands; i++){
-
-        if (i != ncommands-1){ //no need for new pipe in last command
-             //Init current pipe. Use its write end only in the current command (read end will be used in next command). 
-             //Current command reads from prev pipe.
-             if (pipe(pipe_fds + 2*i) == -1){ 
-                perror("pipe");
-                free(sliced_tokens);
+        int first = i == 0;
+        //A captured last command writes to its pipe like any other.
+        int last = i == n_pipes;
+
+        if (!last){ //no need for new pipe in last command
+            //Init current pipe. Use its write end only in the current command (read end will be used in next command).
+            //Current command reads from prev pipe. Output captured through a pty is read from its master side.
+            int use_pty = capture == CAPTURE_PTY && i == ncommands-1;
+            if (use_pty ? lastout_open_pty(pipe_fds + 2*i, STDOUT_FILENO) != 0 : pipe(pipe_fds + 2*i) == -1){
+                perror(use_pty ? "pty" : "pipe");
+                if (!first){
+                    close(pipe_fds[2*i-2]);
+                }
+                wait_pipeline(p);
                 return 1;
             }
         }
-    
+
+        //The program was located when the pipeline was planned. The exec cache
+        //still checks that the file at that path has not been replaced.
+        const char *path = p->paths[i];
+        int fd = path != NULL ? exec_cache_get(exec_cache, path) : -1;
+
         pid_t child_pid = fork();
         if (child_pid == -1){
-            
-            if (close(pipe_fds[2*i]) == -1){
-                perror("close");
-                free(sliced_tokens);
-                return 1;
+            perror("fork");
+            if (!first){
+                close(pipe_fds[2*i-2]);
             }
-            if (close(pipe_fds[2*i+1]) == -1){
-                perror("close");
-                free(sliced_tokens);
-                return 1;
+            if (!last){
+                close_all(pipe_fds + 2*i, 2);
             }
-
-            perror("fork");
-            free(sliced_tokens);
+            wait_pipeline(p);
             return 1;
 
         } else if (child_pid == 0){
-             
-            //Not sure if this solves freeing in child or not, but I can't think of another way to free before execing.
-            //Copy from heap to stack to avoid having to free after run_command/exec, passing in the stack pointer, and freeing heap before entering function.
-            strvec_t cur_token_vector;
-            memcpy(&cur_token_vector, sliced_tokens+i, sizeof(strvec_t));
-            
-            free(sliced_tokens);
-            
-            if (i == 0){ //first command, does not read from a pipe. reads from STDIN
-                
-                //Closes current read end, not needed as only next child will be reading
-                if (close(pipe_fds[2*i]) == -1){
-                    perror("close");
-                    exit(1);
-                }
-
-                if (run_piped_command(&cur_token_vector, pipe_fds, num_pipes, -1, 1) == -1){
-                    fprintf(stderr, "Error run_piped_command\n");
-                    exit(1);
-                }
-
-            } else if (i == ncommands-1){ //last command, does not write to a pipe. writes to STDOUT
 
-                 //No pipe is created for this child, no read end to close.
+            //Background commands get a process group of their own, so Ctrl-C at the
+            //prompt does not reach them, and do not compete with the shell for the
+            //terminal's input. A redirection can still give them other input.
+            if (p->background){
+                setpgid(0, p->pgid);
+            }
+            int in_fd = p->in_fd;
+            if (first && in_fd == -1 && p->background){
+                in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            }
+            if (first && in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1){
+                perror("dup2");
+                _exit(1);
+            }
 
-                if (run_piped_command(&cur_token_vector, pipe_fds, num_pipes, 2*(ncommands-1)-2, -1) == -1){
-                    fprintf(stderr, "Error run_piped_command\n");
-                    exit(1);
-                }
+            //Closes current read end, not needed as only next child will be reading.
+            //The last command has no pipe of its own.
+            if (!last && close(pipe_fds[2*i]) == -1){
+                perror("close");
+                _exit(1);
+            }
 
-            } else { //middle command, reads from a pipe, writes to a pipe
+            //The first command reads from STDIN and the last writes to STDOUT.
+            int in_idx = first ? -1 : 2*i-2;
+            int out_idx = last ? -1 : 2*i+1;
+            run_piped_command(p->plans+i, pipe_fds, 2*n_pipes, in_idx, out_idx, path, fd);
+            //Only reached if the command could not be run. _exit() does not flush
+            //the stdio buffers inherited from the shell, which would print them twice.
+            _exit(1);
 
-                //Closes current read end, not needed as next child will be reading
-                if (close(pipe_fds[2*i]) == -1){
-                    perror("close");
-                    exit(1);
-                }
+        } else { //parent
 
-                if (run_piped_command(&cur_token_vector, pipe_fds, num_pipes, 2*i-2, 2*i+1) == -1){
-                    fprintf(stderr, "Error run_piped_command\n");
-                    exit(1);
+            p->pids[p->n_started++] = child_pid;
+            //Set by the parent as well, so the group exists before the next child joins it.
+            if (p->background){
+                if (p->pgid == 0){
+                    p->pgid = child_pid;
                 }
+                setpgid(child_pid, p->pgid);
             }
 
-            exit(0); //never reached
-        
-        } else { //parent
-
-            if (i != 0){ //If not first command, close previous read end
+            if (!first){ //If not first command, close previous read end
                 if (close(pipe_fds[2*i-2]) == -1) {
                     perror("close");
-                    free(sliced_tokens);
-                    return 1;
                 }
             }
 
             //Does not close current read end, since next child will need it.
             //In case of last command, no current read end to close since no pipe created.
 
-            if (i != ncommands-1){ //If not last command, close current write end.
+            if (!last){ //If not last command, close current write end.
                 if (close(pipe_fds[2*i + 1]) == -1) {
                     perror("close");
-                    free(sliced_tokens);
-                    return 1;
-                }  
+                }
             }
-            
-           
-        } 
+        }
         //Summary of how I closed pipe fds: write and read ends needed to dup2 are closed in parent right away, and in child after dup2'ing.
-        //However, current read ends are allowed to stay through parent so read in next child succeeds, child removes instantly, 
+        //However, current read ends are allowed to stay through parent so read in next child succeeds, child removes instantly,
         //then is removed in next iteration by parent as previous read.
     }
-    
-    //Waits on all children to finish to initiate new prompt.
-    for (int i = 0; i < ncommands; i++){
-        if (wait(NULL) == -1){
-            perror("wait");
-            free(sliced_tokens);
-            return 1;
+
+    //The read end of the output pipe is left open for the caller.
+    if (capture){
+        p->out_fd = pipe_fds[2*n_pipes-2];
+    }
+    return 0;
+}
+
+int wait_pipeline(pipeline_t *p) {
+    int ret_val = 0;
+    for (int i = 0; i < p->n_started; i++){
+        if (waitpid(p->pids[i], NULL, 0) == -1){
+            perror("waitpid");
+            ret_val = 1;
         }
     }
+    p->n_started = 0;
+    return ret_val;
+}
 
-    //frees target vectors array.
-    free(sliced_tokens);
+int reap_pipeline(pipeline_t *p) {
+    //Finished commands are swapped out of the started ones, which stay unordered.
+    for (int i = p->n_started-1; i >= 0; i--){
+        pid_t pid = waitpid(p->pids[i], NULL, WNOHANG);
+        if (pid == p->pids[i] || (pid == -1 && errno == ECHILD)){
+            p->pids[i] = p->pids[--p->n_started];
+        }
+    }
+    return p->n_started == 0;
+}
 
-    return 0;
+void signal_pipeline(pipeline_t *p, int sig) {
+    //The whole group of a background pipeline is signalled, reaching the
+    //processes its commands started too.
+    if (p->pgid != 0){
+        killpg(p->pgid, sig);
+        return;
+    }
+    for (int i = 0; i < p->n_started; i++){
+        kill(p->pids[i], sig);
+    }
+}
+
+int run_pipelined_commands(strvec_t *tokens, cmd_cache_t *cache, exec_cache_t *exec_cache, arena_t *arena,
+                           lastout_t *lastout) {
+    pipeline_t p;
+    if (plan_pipeline(tokens, cache, arena, &p) != 0){
+        return 1;
+    }
+
+    //With bulk output, the output file is written by a copier process fed by
+    //the pipeline's captured output.
+    off_t size_hint;
+    redir_file_t output;
+    int copy_output = bulk_output_enabled(&size_hint) && redir_take_output(p.plans+p.ncommands-1, &output) == 0;
+    //Output is only kept when it would have reached the shell's own stdout.
+    redir_source_t out = p.plans[p.ncommands-1].fds[STDOUT_FILENO];
+    int keep_output = !copy_output && lastout_enabled(lastout) &&
+                      out.kind == REDIR_ORIGINAL && out.index == STDOUT_FILENO;
+
+    //Kept output is captured through a pty when the shell writes to a terminal,
+    //so the last command still sees one on its stdout and keeps its colors
+    //and line buffering.
+    int capture = CAPTURE_NONE;
+    if (copy_output || keep_output){
+        capture = keep_output && isatty(STDOUT_FILENO) ? CAPTURE_PTY : CAPTURE_PIPE;
+    }
+    if (start_pipeline(&p, exec_cache, capture) != 0){
+        return 1;
+    }
+
+    //The shell passes the output on itself, keeping its end as it goes.
+    int ret_val = 0;
+    if (keep_output){
+        fflush(stdout);
+        if (lastout_capture(lastout, p.out_fd, STDOUT_FILENO) != 0){
+            perror("lastout");
+            ret_val = 1;
+        }
+        if (close(p.out_fd) == -1){
+            perror("close");
+        }
+    }
+
+    //Without a copier process, the shell copies the output itself rather
+    //than lose it, and only prompts again once the copy is done.
+    pid_t copier = -1;
+    if (copy_output){
+        copier = fork();
+        if (copier == -1){
+            perror("fork");
+            ret_val = 1;
+            bulk_output_copy(p.out_fd, &output, size_hint);
+        } else if (copier == 0){
+            _exit(bulk_output_copy(p.out_fd, &output, size_hint));
+        }
+        if (close(p.out_fd) == -1){
+            perror("close");
+        }
+    }
+
+    //Waits on all children to finish to initiate new prompt.
+    if (wait_pipeline(&p) != 0){
+        ret_val = 1;
+    }
+    int status;
+    if (copier > 0){
+        if (waitpid(copier, &status, 0) == -1){
+            perror("waitpid");
+            ret_val = 1;
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            ret_val = 1;
+        }
+    }
+    return ret_val;
 }
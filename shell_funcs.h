@@ -1,6 +1,14 @@
 #ifndef SHELL_FUNCS_H
 #define SHELL_FUNCS_H
 
+#include <sys/types.h>
+
+#include "arena.h"
+#include "cmd_cache.h"
+#include "exec_cache.h"
+#include "lastout.h"
+#include "redirect.h"
+
 /*
  * Divide a string with substrings separated by a single space (" ")
  * into tokens . These tokens should be stored in the 'tokens' vector using
@@ -20,15 +28,105 @@ int tokenize(char *s, strvec_t *tokens);
  */
 int run_command(strvec_t *tokens);
 
+/*
+ * Run a user-specified command like run_command, but from a plan of its
+ * arguments and redirections, and executing the program at 'path' rather
+ * than searching $PATH for it
+ * This should be called within a CHILD process of the shell
+ * plan: Arguments and redirections of the command
+ * path: Location of the program, or NULL to search $PATH
+ * fd: Open descriptor of the program at 'path', or -1
+ * Doesn't return on success (similar to exec) or returns 1 on error
+ */
+int exec_command(const redir_plan_t *plan, const char *path, int fd);
+
+// A pipeline ready to run, possibly many times: the plan of each command and
+// the location of its program
+typedef struct {
+    redir_plan_t *plans;
+    const char **paths;     // Location of each program, or NULL to search $PATH
+    int ncommands;
+    int *pipe_fds;          // Room for the pipes between commands and the output pipe
+    pid_t *pids;            // Processes of the commands started
+    int n_started;
+    int out_fd;             // Read end of the output pipe, or -1
+    int in_fd;              // Read by the first command instead of stdin, or -1
+    int background;         // Run in a process group of its own, reading /dev/null
+                            // unless 'in_fd' is set
+    pid_t pgid;             // Process group of a background pipeline once started
+} pipeline_t;
+
+/*
+ * Parse the commands of a pipeline and locate their programs. The pipeline
+ * runs in the foreground unless 'background' is set before it is started,
+ * and reads the shell's stdin unless 'in_fd' is.
+ * tokens: Vector containing tokens input by user into shell
+ * cache: Pointer to the command cache used to locate programs
+ * arena: Arena the pipeline is allocated from
+ * p: Receives the pipeline, which refers to the strings of 'tokens'
+ * Returns 0 on success or 1 on error.
+ */
+int plan_pipeline(strvec_t *tokens, cmd_cache_t *cache, arena_t *arena, pipeline_t *p);
+
+// Where start_pipeline() sends the output of the last command
+#define CAPTURE_NONE 0
+#define CAPTURE_PIPE 1
+#define CAPTURE_PTY 2   // Shell's stdout must be a terminal, see lastout_open_pty()
+
+/*
+ * Start the commands of a planned pipeline, connected by pipes
+ * p: Pointer to the pipeline, which must not be running
+ * exec_cache: Pointer to the cache of open programs
+ * capture: CAPTURE_PIPE or CAPTURE_PTY to have the last command write to a
+ *          pipe or a pseudo-terminal rather than to standard output, with
+ *          the end the output is read from left in p->out_fd for the caller
+ *          to read and close, or CAPTURE_NONE
+ * Returns 0 on success or 1 on error, in which case the commands already
+ * started have been waited for
+ */
+int start_pipeline(pipeline_t *p, exec_cache_t *exec_cache, int capture);
+
+/*
+ * Wait for the commands of a started pipeline to finish
+ * p: Pointer to the pipeline
+ * Returns 0 on success or 1 on error.
+ */
+int wait_pipeline(pipeline_t *p);
+
+/*
+ * Reap the commands of a started pipeline that have finished, without waiting
+ * for the others
+ * p: Pointer to the pipeline
+ * Returns 1 if all of its commands have finished, 0 otherwise
+ */
+int reap_pipeline(pipeline_t *p);
+
+/*
+ * Send a signal to the commands of a started pipeline that have not finished.
+ * A background pipeline's whole process group is signalled, including the
+ * processes its commands started.
+ * p: Pointer to the pipeline
+ * sig: The signal
+ */
+void signal_pipeline(pipeline_t *p, int sig);
+
 /*
  * Run a sequence of commands in a shell pipeline. For each program 'i' in the sequence,
  * standard input is consumed from the output of program 'i-1' while standard output is
  * sent as the standard input of program 'i+1'. The exceptions are the first program,
  * which does not have a predecessor program to consume input from, and the last program,
  * which does not have a successor program to send output to.
+ * Programs are located and opened by the parent before forking, through
+ * 'cache' and 'exec_cache'.
  * tokens: Vector containing tokens input by user into shell.
+ * cache: Pointer to the command cache used to locate programs
+ * exec_cache: Pointer to the cache of open programs
+ * arena: Arena for the pipeline's own tables, which are not freed
+ * lastout: Buffer that keeps the end of the output going to the shell's
+ *          standard output, or NULL
  * Returns 0 on success or 1 on error.
  */
-int run_pipelined_commands(strvec_t *tokens);
+int run_pipelined_commands(strvec_t *tokens, cmd_cache_t *cache, exec_cache_t *exec_cache, arena_t *arena,
+                           lastout_t *lastout);
 
 #endif // SHELL_FUNCS_H
@@ -1,80 +1,508 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "string_vector.h"
 
 #define INITIAL_SIZE 4
+#define ARENA_BLOCK_SIZE 512
+#define INITIAL_INTERN_SIZE 256
 
-int strvec_init(strvec_t *vec) {
+// Runs of entries smaller than this are sorted by multikey quicksort rather
+// than another radix sort, and smaller partitions than INSERTION_CUTOFF by
+// insertion sort
+#define RADIX_CUTOFF 64
+#define INSERTION_CUTOFF 8
+
+// ID of elements that are not interned
+#define NO_ID 0
+
+// Table of the strings searched for, shared by all vectors of all threads.
+// It is read without locking: a string is stored before its ID is published
+// in the table, and a table that fills up is replaced by a bigger copy rather
+// than resized. Replaced tables are kept, as other threads may still be
+// reading them, and add up to less than the current one.
+struct intern_table {
+    uint32_t capacity;
+    _Atomic uint32_t *ids;          // Open addressing table of IDs, NO_ID if free
+    char **strings;                 // String of each ID, starting with ID 1
+    struct intern_table *previous;
+};
+
+static struct {
+    pthread_mutex_t lock;           // Held while adding strings
+    struct intern_table *_Atomic table;
+    _Atomic uint32_t count;
+} interned = { PTHREAD_MUTEX_INITIALIZER };
+
+static uint32_t hash_string(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s != '\0'; s++) {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Insert an ID into a table that has a free entry for it
+ */
+static void insert_id(struct intern_table *t, uint32_t id) {
+    uint32_t i = hash_string(t->strings[id]) & (t->capacity - 1);
+    while (atomic_load_explicit(&t->ids[i], memory_order_relaxed) != NO_ID) {
+        i = (i + 1) & (t->capacity - 1);
+    }
+    atomic_store_explicit(&t->ids[i], id, memory_order_release);
+}
+
+/*
+ * Publish a copy of the intern table twice as big. The caller holds the lock.
+ * Returns the new table, or NULL on error
+ */
+static struct intern_table *grow_interned(struct intern_table *old, uint32_t count) {
+    struct intern_table *t = malloc(sizeof(struct intern_table));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->capacity = old == NULL ? INITIAL_INTERN_SIZE : 2 * old->capacity;
+    t->ids = calloc(t->capacity, sizeof(uint32_t));
+    // strings[0] is unused, so there is room for an ID per table entry
+    t->strings = malloc(t->capacity * sizeof(char *));
+    if (t->ids == NULL || t->strings == NULL) {
+        free(t->ids);
+        free(t->strings);
+        free(t);
+        return NULL;
+    }
+    t->previous = old;
+    for (uint32_t id = 1; id <= count; id++) {
+        t->strings[id] = old->strings[id];
+        insert_id(t, id);
+    }
+    atomic_store_explicit(&interned.table, t, memory_order_release);
+    return t;
+}
+
+/*
+ * Find the ID of a string without locking
+ * Returns the ID, or NO_ID if the string is not interned
+ */
+static uint32_t lookup_interned(const char *s) {
+    struct intern_table *t = atomic_load_explicit(&interned.table, memory_order_acquire);
+    if (t == NULL) {
+        return NO_ID;
+    }
+    uint32_t i = hash_string(s) & (t->capacity - 1);
+    uint32_t id;
+    while ((id = atomic_load_explicit(&t->ids[i], memory_order_acquire)) != NO_ID) {
+        if (strcmp(t->strings[id], s) == 0) {
+            return id;
+        }
+        i = (i + 1) & (t->capacity - 1);
+    }
+    return NO_ID;
+}
+
+int strvec_intern(const char *s) {
+    int ret = 0;
+    pthread_mutex_lock(&interned.lock);
+    if (lookup_interned(s) == NO_ID) {
+        struct intern_table *t = atomic_load_explicit(&interned.table, memory_order_relaxed);
+        uint32_t count = atomic_load_explicit(&interned.count, memory_order_relaxed);
+        // Keep the table at most half full
+        if (t == NULL || 2 * (count + 1) > t->capacity) {
+            t = grow_interned(t, count);
+        }
+        char *copy = t != NULL ? strdup(s) : NULL;
+        if (copy != NULL) {
+            t->strings[count + 1] = copy;
+            insert_id(t, count + 1);
+            // Vectors initialized from now on know the ID
+            atomic_store_explicit(&interned.count, count + 1, memory_order_release);
+        } else {
+            ret = 1;
+        }
+    }
+    pthread_mutex_unlock(&interned.lock);
+    return ret;
+}
+
+/*
+ * Find the first position at or after 'start' holding an ID
+ * Returns the position, or 'n' if there is none
+ */
+static unsigned scan_ids(const uint32_t *ids, unsigned start, unsigned n, uint32_t id) {
+    unsigned i = start;
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi32(id);
+    for (; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (ids + i)), needle);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (ids[i] == id) {
+            return i;
+        }
+    }
+    return n;
+}
+
+/*
+ * Find the last position before 'end' holding an ID
+ * Returns the position, or -1 if there is none
+ */
+static int scan_ids_reverse(const uint32_t *ids, unsigned end, uint32_t id) {
+    unsigned i = end;
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi32(id);
+    for (; i >= 4; i -= 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (ids + i - 4)), needle);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask != 0) {
+            return i - 4 + (31 - __builtin_clz(mask));
+        }
+    }
+#endif
+    while (i > 0) {
+        i--;
+        if (ids[i] == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// A block of long strings. Strings never move once added, and blocks are only
+// freed with the whole vector.
+struct strvec_block {
+    struct strvec_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+/*
+ * Copy a string of length 'len' into an arena
+ * Returns the copy, or NULL on error
+ */
+static char *arena_add(struct strvec_block **arena, const char *s, size_t len) {
+    struct strvec_block *block = *arena;
+    if (block == NULL || block->size - block->used < len + 1) {
+        size_t size = len + 1 > ARENA_BLOCK_SIZE ? len + 1 : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(struct strvec_block) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = *arena;
+        block->used = 0;
+        block->size = size;
+        *arena = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, s, len + 1);
+    block->used += len + 1;
+    return copy;
+}
+
+/*
+ * Allocate memory for a vector, from its arena if it has one
+ * Returns the memory, or NULL on error
+ */
+static void *vec_alloc(const strvec_t *vec, size_t size) {
+    return vec->mem != NULL ? arena_alloc(vec->mem, size) : malloc(size);
+}
+
+static void vec_release(const strvec_t *vec, void *p) {
+    if (vec->mem == NULL) {
+        free(p);
+    }
+}
+
+static const char *slot_str(const strvec_slot_t *slot) {
+    return slot->arena.is_long ? slot->arena.str : slot->inline_str;
+}
+
+/*
+ * Store a string in a slot, or if it is too long for the slot, in 'mem' if
+ * it is set and in the blocks of 'arena' otherwise
+ * Returns 0 on success, 1 on error
+ */
+static int set_slot(strvec_slot_t *slot, struct strvec_block **arena, arena_t *mem, const char *s) {
+    size_t len = strlen(s);
+    if (len < STRVEC_INLINE_LEN) {
+        memcpy(slot->inline_str, s, len + 1);
+        slot->arena.is_long = 0;
+    } else {
+        if (mem != NULL) {
+            if ((slot->arena.str = arena_alloc(mem, len + 1)) != NULL) {
+                memcpy(slot->arena.str, s, len + 1);
+            }
+        } else {
+            slot->arena.str = arena_add(arena, s, len);
+        }
+        if (slot->arena.str == NULL) {
+            return 1;
+        }
+        slot->arena.is_long = 1;
+    }
+    return 0;
+}
+
+static void free_arena(struct strvec_block *arena) {
+    while (arena != NULL) {
+        struct strvec_block *next = arena->next;
+        free(arena);
+        arena = next;
+    }
+}
+
+/*
+ * Initialize an empty vector with room for 'capacity' elements, keeping an
+ * argv array if 'with_argv' is set
+ * Returns 0 on success, 1 on error
+ */
+static int init(strvec_t *vec, unsigned capacity, int with_argv) {
+    if (capacity == 0) {
+        capacity = 1;
+    }
     vec->length = 0;
-    vec->capacity = INITIAL_SIZE;
-    vec->data = malloc(INITIAL_SIZE * sizeof(char *));
-    if (vec->data == NULL) {
+    vec->capacity = capacity;
+    vec->arena = NULL;
+    vec->is_view = 0;
+    vec->with_argv = with_argv;
+    vec->n_interned = atomic_load_explicit(&interned.count, memory_order_acquire);
+    vec->slots = vec_alloc(vec, capacity * sizeof(strvec_slot_t));
+    vec->ids = vec_alloc(vec, capacity * sizeof(uint32_t));
+    vec->argv = with_argv ? vec_alloc(vec, (capacity + 1) * sizeof(char *)) : NULL;
+    if (vec->slots == NULL || vec->ids == NULL || (with_argv && vec->argv == NULL)) {
+        vec_release(vec, vec->slots);
+        vec_release(vec, vec->ids);
+        vec_release(vec, vec->argv);
         return 1;
     }
+    if (with_argv) {
+        vec->argv[0] = NULL;
+    }
 
     return 0;
 }
 
+/*
+ * Resize the arrays of a vector whose memory comes from an arena. The old
+ * arrays stay in the arena until it is reset.
+ * Returns 0 on success, 1 on error
+ */
+static int resize_in_arena(strvec_t *vec, unsigned capacity) {
+    if (capacity <= vec->capacity) {
+        return 0;
+    }
+    strvec_slot_t *new_slots = arena_alloc(vec->mem, capacity * sizeof(strvec_slot_t));
+    uint32_t *new_ids = arena_alloc(vec->mem, capacity * sizeof(uint32_t));
+    char **new_argv = vec->with_argv ? arena_alloc(vec->mem, (capacity + 1) * sizeof(char *)) : NULL;
+    if (new_slots == NULL || new_ids == NULL || (vec->with_argv && new_argv == NULL)) {
+        return 1;
+    }
+    memcpy(new_slots, vec->slots, vec->length * sizeof(strvec_slot_t));
+    memcpy(new_ids, vec->ids, vec->length * sizeof(uint32_t));
+    vec->slots = new_slots;
+    vec->ids = new_ids;
+    if (vec->with_argv) {
+        vec->argv = new_argv;
+        for (unsigned i = 0; i < vec->length; i++) {
+            vec->argv[i] = (char *) slot_str(&vec->slots[i]);
+        }
+        vec->argv[vec->length] = NULL;
+    }
+    vec->capacity = capacity;
+    return 0;
+}
+
+/*
+ * Resize the arrays of a vector to hold 'capacity' elements. If some array
+ * cannot be resized, it keeps its old size, so the vector stays usable with
+ * the smaller of the two capacities.
+ * Returns 0 on success, 1 on error
+ */
+static int resize(strvec_t *vec, unsigned capacity) {
+    if (vec->mem != NULL) {
+        return resize_in_arena(vec, capacity);
+    }
+    int ret = 0;
+    strvec_slot_t *new_slots = realloc(vec->slots, capacity * sizeof(strvec_slot_t));
+    if (new_slots != NULL) {
+        vec->slots = new_slots;
+    } else {
+        ret = 1;
+    }
+    uint32_t *new_ids = realloc(vec->ids, capacity * sizeof(uint32_t));
+    if (new_ids != NULL) {
+        vec->ids = new_ids;
+    } else {
+        ret = 1;
+    }
+    if (vec->with_argv) {
+        char **new_argv = realloc(vec->argv, (capacity + 1) * sizeof(char *));
+        if (new_argv != NULL) {
+            vec->argv = new_argv;
+        } else {
+            ret = 1;
+        }
+        // Inline strings move with their slots
+        for (unsigned i = 0; i < vec->length; i++) {
+            vec->argv[i] = (char *) slot_str(&vec->slots[i]);
+        }
+    }
+    if (ret == 0 || capacity < vec->capacity) {
+        vec->capacity = capacity;
+    }
+    return ret;
+}
+
+int strvec_init(strvec_t *vec) {
+    vec->mem = NULL;
+    return init(vec, INITIAL_SIZE, 0);
+}
+
+int strvec_init_argv(strvec_t *vec) {
+    vec->mem = NULL;
+    return init(vec, INITIAL_SIZE, 1);
+}
+
+int strvec_init_size(strvec_t *vec, unsigned size) {
+    vec->mem = NULL;
+    return init(vec, size, 0);
+}
+
+int strvec_init_arena(strvec_t *vec, arena_t *arena, unsigned size, int with_argv) {
+    vec->mem = arena;
+    return init(vec, size, with_argv);
+}
+
+int strvec_reserve(strvec_t *vec, unsigned n) {
+    if (vec->is_view) {
+        return 1;
+    }
+    if (vec->capacity == 0) {
+        return init(vec, n, vec->with_argv);
+    }
+    return n > vec->capacity ? resize(vec, n) : 0;
+}
+
+int strvec_shrink_to_fit(strvec_t *vec) {
+    if (vec->is_view || vec->mem != NULL || vec->capacity == 0 || vec->length == vec->capacity) {
+        return 0;
+    }
+    return resize(vec, vec->length > 0 ? vec->length : 1);
+}
+
 void strvec_clear(strvec_t *vec) {
     if (vec->capacity == 0) {
         return;
     }
-    for (int i = 0; i < vec->length; i++) {
-        free(vec->data[i]);
+    if (vec->is_view) {
+        vec->length = 0;
+        vec->capacity = 0;
+        vec->is_view = 0;
+        vec->with_argv = 0;
+        return;
     }
-    free(vec->data);
+    free_arena(vec->arena);
+    vec->arena = NULL;
+    vec_release(vec, vec->slots);
+    vec_release(vec, vec->ids);
+    vec_release(vec, vec->argv);
 
+    // The argv mode is kept for when the vector is reused
     vec->length = 0;
     vec->capacity = 0;
 }
 
 int strvec_add(strvec_t *vec, const char *s) {
+    // Views do not own their elements
+    if (vec->is_view) {
+        return 1;
+    }
+
     // If vector was previously cleared, need to reinitialize
     if (vec->capacity == 0) {
-        if (strvec_init(vec) != 0) {
+        if (init(vec, INITIAL_SIZE, vec->with_argv) != 0) {
             return 1;
         }
     }
 
     if (vec->length == vec->capacity) {
-        // Expand underlying array
-        char **new_data = realloc(vec->data, 2* vec->capacity * sizeof(char *));
-        if (new_data == NULL) {
+        // Expand underlying arrays
+        if (resize(vec, 2 * vec->capacity) != 0) {
             return 1;
-        } else {
-            vec->data = new_data;
         }
-        vec->capacity = vec->capacity * 2;
     }
 
-    if ((vec->data[vec->length] = malloc((strlen(s) + 1) * sizeof(char))) == NULL) {
+    // Elements are only looked up, so the table does not grow with every
+    // distinct token
+    vec->ids[vec->length] = lookup_interned(s);
+
+    strvec_slot_t *slot = &vec->slots[vec->length];
+    if (set_slot(slot, &vec->arena, vec->mem, s) != 0) {
         return 1;
     }
-    strcpy(vec->data[vec->length], s);
+    if (vec->with_argv) {
+        vec->argv[vec->length] = (char *) slot_str(slot);
+        vec->argv[vec->length + 1] = NULL;
+    }
     vec->length++;
     return 0;
 }
 
+char **strvec_argv(const strvec_t *vec) {
+    if (!vec->with_argv || vec->capacity == 0 || vec->argv[vec->length] != NULL) {
+        return NULL;
+    }
+    return vec->argv;
+}
+
 char *strvec_get(const strvec_t *vec, unsigned i) {
     if (i >= vec->length) {
         return NULL;
     }
 
-    return vec->data[i];
+    return (char *) slot_str(&vec->slots[i]);
 }
 
-int strvec_find(const strvec_t *vec, const char *s) {
-    for (int i = 0; i < vec->length; i++) {
-        if (strcmp(vec->data[i], s) == 0) {
-            return i;
-        }
+/*
+ * Find the first element at or after 'start' equal to 's', whose ID is 'id'.
+ * IDs are compared if the vector's elements know 'id', and strings otherwise.
+ * Returns the position, or the length of the vector if there is none
+ */
+static unsigned find_next(const strvec_t *vec, unsigned start, const char *s, uint32_t id) {
+    if (id != NO_ID && id <= vec->n_interned) {
+        return scan_ids(vec->ids, start, vec->length, id);
     }
-    return -1;
+    unsigned i = start;
+    while (i < vec->length && strcmp(slot_str(&vec->slots[i]), s) != 0) {
+        i++;
+    }
+    return i;
+}
+
+int strvec_find(const strvec_t *vec, const char *s) {
+    unsigned i = find_next(vec, 0, s, lookup_interned(s));
+    return i < vec->length ? i : -1;
 }
 
 int strvec_find_last(const strvec_t *vec, const char *s) {
-    for (int i = vec->length - 1; i >= 0; i--) {
-        if (strcmp(vec->data[i], s) == 0) {
+    uint32_t id = lookup_interned(s);
+    if (id != NO_ID && id <= vec->n_interned) {
+        return scan_ids_reverse(vec->ids, vec->length, id);
+    }
+    for (int i = (int) vec->length - 1; i >= 0; i--) {
+        if (strcmp(slot_str(&vec->slots[i]), s) == 0) {
             return i;
         }
     }
@@ -82,24 +510,22 @@ int strvec_find_last(const strvec_t *vec, const char *s) {
 }
 
 int strvec_num_occurrences(const strvec_t *vec, const char *s) {
+    uint32_t id = lookup_interned(s);
     int num_occurrences = 0;
-    for (int i = 0; i < vec->length; i++) {
-        if (strcmp(vec->data[i], s) == 0) {
-            num_occurrences++;
-        }
+    for (unsigned i = find_next(vec, 0, s, id); i < vec->length; i = find_next(vec, i + 1, s, id)) {
+        num_occurrences++;
     }
     return num_occurrences;
 }
 
 void strvec_take(strvec_t *vec, unsigned n) {
-    if (n > vec->length) {
-        n = vec->length;
-    }
-
-    for (int i = n; i < vec->length; i++) {
-        free(vec->data[i]);
+    // Long strings past 'n' stay in the arena until the vector is cleared
+    if (n < vec->length) {
+        vec->length = n;
+        if (vec->with_argv && !vec->is_view) {
+            vec->argv[n] = NULL;
+        }
     }
-    vec->length = n;
 }
 
 int strvec_slice(const strvec_t *src, strvec_t *dest, int start, int end) {
@@ -110,7 +536,7 @@ int strvec_slice(const strvec_t *src, strvec_t *dest, int start, int end) {
         end = src->length;
     }
 
-    if (strvec_init(dest) != 0) {
+    if (strvec_init_size(dest, end > start ? end - start : 0) != 0) {
         return 1;
     }
     for (int i = start; i < end; i++) {
@@ -121,3 +547,327 @@ int strvec_slice(const strvec_t *src, strvec_t *dest, int start, int end) {
 
     return 0;
 }
+
+void strvec_move(strvec_t *dest, strvec_t *src) {
+    if (dest != src) {
+        strvec_clear(dest);
+        *dest = *src;
+        src->length = 0;
+        src->capacity = 0;
+        src->is_view = 0;
+        src->with_argv = 0;
+    }
+}
+
+void strvec_view(const strvec_t *src, strvec_t *view, int start, int end) {
+    if (end > src->length) {
+        end = src->length;
+    }
+    if (start < 0) {
+        start = 0;
+    }
+    if (start > end) {
+        start = end;
+    }
+
+    view->length = end - start;
+    // A view is never empty in the sense of a cleared vector, which would be
+    // re-initialized by strvec_add
+    view->capacity = view->length > 0 ? view->length : 1;
+    view->slots = src->slots + start;
+    view->ids = src->ids + start;
+    view->n_interned = src->n_interned;
+    view->argv = src->with_argv ? src->argv + start : NULL;
+    view->arena = NULL;
+    view->mem = NULL;
+    view->is_view = 1;
+    view->with_argv = src->with_argv;
+}
+
+int strvec_split_on(strvec_t *src, const char *sep, arena_t *arena, strvec_t **views, unsigned *n_views) {
+    unsigned n = strvec_num_occurrences(src, sep) + 1;
+    strvec_t *parts = arena != NULL ? arena_alloc(arena, n * sizeof(strvec_t)) : malloc(n * sizeof(strvec_t));
+    if (parts == NULL) {
+        return 1;
+    }
+
+    uint32_t id = lookup_interned(sep);
+    unsigned start = 0;
+    for (unsigned i = 0; i < n - 1; i++) {
+        unsigned end = find_next(src, start, sep, id);
+        // The separator's argv entry becomes the sentinel of the part before it
+        if (src->with_argv) {
+            src->argv[end] = NULL;
+        }
+        strvec_view(src, &parts[i], start, end);
+        start = end + 1;
+    }
+    strvec_view(src, &parts[n - 1], start, src->length);
+
+    *views = parts;
+    *n_views = n;
+    return 0;
+}
+
+// An element being sorted: its position before sorting, and the 8
+// characters of its string from the last multiple of 8 at or below the
+// current depth. Sorting reads characters from the cached key, so it only
+// reads the strings once every 8 characters, and moves 16 byte entries.
+struct sort_entry {
+    uint64_t key;
+    uint32_t idx;
+};
+
+#define KEY_CHARS 8
+
+// Inputs at least this large are radix sorted 16 bits at a time rather than 8
+#define WIDE_RADIX_MIN 65536
+
+// What every step of a sort shares
+struct sort_ctx {
+    const strvec_slot_t *slots;   // Elements, in their order before sorting
+    struct sort_entry *tmp;       // Scratch space for as many entries
+    uint32_t *count;              // Scratch counts for 16 bit digits
+};
+
+static const unsigned char *entry_str(const struct sort_ctx *ctx, const struct sort_entry *e) {
+    return (const unsigned char *) slot_str(&ctx->slots[e->idx]);
+}
+
+/*
+ * Load the keys of entries for the characters starting at 'depth', a
+ * multiple of KEY_CHARS. Characters past the end of a string are 0.
+ */
+static void load_keys(const struct sort_ctx *ctx, struct sort_entry *a, size_t n, size_t depth) {
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char *p = entry_str(ctx, &a[i]) + depth;
+        uint64_t key = 0;
+        int j = 0;
+        // Strings that ended before 'depth' only ever tie with each other on
+        // a key ending in 0, which is never sorted further
+        for (; j < KEY_CHARS && p[j] != '\0'; j++) {
+            key = key << 8 | p[j];
+        }
+        a[i].key = key << (8 * (KEY_CHARS - j));
+    }
+}
+
+static unsigned char char_at(const struct sort_entry *e, size_t depth) {
+    return e->key >> (8 * (KEY_CHARS - 1 - depth % KEY_CHARS));
+}
+
+static void swap_entries(struct sort_entry *a, size_t i, size_t j) {
+    struct sort_entry tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+/*
+ * Sort entries whose strings share their first 'depth' characters, by
+ * insertion sort
+ */
+static void insertion_sort(const struct sort_ctx *ctx, struct sort_entry *a, size_t n, size_t depth) {
+    for (size_t i = 1; i < n; i++) {
+        struct sort_entry e = a[i];
+        const char *s = (const char *) entry_str(ctx, &e) + depth;
+        size_t j = i;
+        while (j > 0 && strcmp((const char *) entry_str(ctx, &a[j - 1]) + depth, s) > 0) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = e;
+    }
+}
+
+/*
+ * Sort entries whose strings share their first 'depth' characters, by
+ * multikey quicksort: a three-way partition on the character at 'depth',
+ * then the middle part moves on to the next character
+ */
+static void multikey_sort(const struct sort_ctx *ctx, struct sort_entry *a, size_t n, size_t depth) {
+    while (n >= INSERTION_CUTOFF) {
+        if (depth % KEY_CHARS == 0) {
+            load_keys(ctx, a, n, depth);
+        }
+        // Median of three pivot
+        unsigned char x = char_at(&a[0], depth), y = char_at(&a[n / 2], depth), z = char_at(&a[n - 1], depth);
+        unsigned char pivot = x < y ? (y < z ? y : (x < z ? z : x)) : (x < z ? x : (y < z ? z : y));
+
+        // a[0, lt) < pivot, a[lt, i) == pivot, a[gt, n) > pivot
+        size_t lt = 0, i = 0, gt = n;
+        while (i < gt) {
+            unsigned char c = char_at(&a[i], depth);
+            if (c < pivot) {
+                swap_entries(a, lt++, i++);
+            } else if (c > pivot) {
+                swap_entries(a, i, --gt);
+            } else {
+                i++;
+            }
+        }
+        multikey_sort(ctx, a, lt, depth);
+        multikey_sort(ctx, a + gt, n - gt, depth);
+        if (pivot == '\0') {
+            // The middle part is made of equal strings
+            return;
+        }
+        a += lt;
+        n = gt - lt;
+        depth++;
+    }
+    insertion_sort(ctx, a, n, depth);
+}
+
+/*
+ * One pass of an LSD radix sort: move entries from 'from' to 'to' in order of
+ * the digit of their key at 'shift', keeping the order of equal digits.
+ * count: Number of entries with each digit, overwritten
+ * Returns 1 if the entries moved, 0 if they all have the same digit and
+ * were left where they are
+ */
+static int radix_pass(const struct sort_entry *from, struct sort_entry *to, size_t n, int shift, uint64_t mask,
+                      uint32_t *count) {
+    if (count[(from[0].key >> shift) & mask] == n) {
+        return 0;
+    }
+    uint32_t sum = 0;
+    for (uint64_t b = 0; b <= mask; b++) {
+        uint32_t c = count[b];
+        count[b] = sum;
+        sum += c;
+    }
+    for (size_t i = 0; i < n; i++) {
+        to[count[(from[i].key >> shift) & mask]++] = from[i];
+    }
+    return 1;
+}
+
+/*
+ * Sort entries whose strings share their first 'depth' characters, a
+ * multiple of KEY_CHARS. The entries are ordered on their next KEY_CHARS
+ * characters by an LSD radix sort of the cached keys, which reads each
+ * string once and then only moves entries through the scratch space. Runs of
+ * entries whose keys tie and whose strings go on are sorted on the following
+ * characters in turn.
+ */
+static void radix_sort(const struct sort_ctx *ctx, struct sort_entry *a, size_t n, size_t depth) {
+    if (n < RADIX_CUTOFF) {
+        multikey_sort(ctx, a, n, depth);
+        return;
+    }
+    load_keys(ctx, a, n, depth);
+
+    int bits = n >= WIDE_RADIX_MIN ? 16 : 8;
+    int passes = 64 / bits;
+    uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    uint32_t narrow[KEY_CHARS][256];
+    uint32_t *count = bits == 16 ? ctx->count : &narrow[0][0];
+    memset(count, 0, passes * (mask + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = a[i].key;
+        for (int d = 0; d < passes; d++) {
+            count[d * (mask + 1) + ((key >> (d * bits)) & mask)]++;
+        }
+    }
+    struct sort_entry *from = a, *to = ctx->tmp;
+    for (int d = 0; d < passes; d++) {
+        if (radix_pass(from, to, n, d * bits, mask, count + d * (mask + 1))) {
+            struct sort_entry *t = from;
+            from = to;
+            to = t;
+        }
+    }
+    if (from != a) {
+        memcpy(a, from, n * sizeof(struct sort_entry));
+    }
+
+    // Keys ending in 0 belong to strings that ended, which are all equal
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && a[j].key == a[i].key) {
+            j++;
+        }
+        if (j - i > 1 && (a[i].key & 0xff) != 0) {
+            radix_sort(ctx, a + i, j - i, depth + KEY_CHARS);
+        }
+        i = j;
+    }
+}
+
+int strvec_sort(strvec_t *vec) {
+    if (vec->is_view) {
+        return 1;
+    }
+    if (vec->length < 2) {
+        return 0;
+    }
+
+    unsigned n = vec->length;
+    struct sort_ctx ctx;
+    ctx.slots = vec->slots;
+    struct sort_entry *entries = malloc(2 * (size_t) n * sizeof(struct sort_entry));
+    ctx.tmp = entries + n;
+    ctx.count = n >= WIDE_RADIX_MIN ? malloc((64 / 16) * 65536 * sizeof(uint32_t)) : NULL;
+    strvec_slot_t *sorted_slots = vec_alloc(vec, vec->capacity * sizeof(strvec_slot_t));
+    uint32_t *sorted_ids = vec_alloc(vec, vec->capacity * sizeof(uint32_t));
+    if (entries == NULL || (n >= WIDE_RADIX_MIN && ctx.count == NULL) || sorted_slots == NULL ||
+        sorted_ids == NULL) {
+        free(entries);
+        free(ctx.count);
+        vec_release(vec, sorted_slots);
+        vec_release(vec, sorted_ids);
+        return 1;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        entries[i].idx = i;
+    }
+
+    radix_sort(&ctx, entries, n, 0);
+
+    // Slots are moved once each, after their order is known. They are read
+    // in no particular order, so the ones a few steps ahead are fetched early.
+    for (unsigned i = 0; i < n; i++) {
+        if (i + 8 < n) {
+            __builtin_prefetch(&vec->slots[entries[i + 8].idx]);
+        }
+        sorted_slots[i] = vec->slots[entries[i].idx];
+        sorted_ids[i] = vec->ids[entries[i].idx];
+    }
+    free(entries);
+    free(ctx.count);
+    vec_release(vec, vec->slots);
+    vec_release(vec, vec->ids);
+    vec->slots = sorted_slots;
+    vec->ids = sorted_ids;
+    if (vec->with_argv) {
+        for (unsigned i = 0; i < n; i++) {
+            vec->argv[i] = (char *) slot_str(&vec->slots[i]);
+        }
+    }
+    return 0;
+}
+
+void strvec_dedupe(strvec_t *vec) {
+    if (vec->is_view || vec->length < 2) {
+        return;
+    }
+    // Equal strings have equal IDs, but elements that are not interned all
+    // share NO_ID
+    unsigned kept = 1;
+    for (unsigned i = 1; i < vec->length; i++) {
+        uint32_t id = vec->ids[i];
+        if (id != vec->ids[kept - 1] ||
+            (id == NO_ID && strcmp(slot_str(&vec->slots[i]), slot_str(&vec->slots[kept - 1])) != 0)) {
+            vec->slots[kept] = vec->slots[i];
+            vec->ids[kept] = vec->ids[i];
+            kept++;
+        }
+    }
+    vec->length = kept;
+    if (vec->with_argv) {
+        for (unsigned i = 0; i < kept; i++) {
+            vec->argv[i] = (char *) slot_str(&vec->slots[i]);
+        }
+        vec->argv[kept] = NULL;
+    }
+}
@@ -1,10 +1,51 @@
 #ifndef STRING_VECTOR_H
 #define STRING_VECTOR_H
 
+#include <stdint.h>
+
+#include "arena.h"
+
+// Strings shorter than this are stored inline in their slot
+#define STRVEC_INLINE_LEN 23
+#define STRVEC_SLOT_SIZE 24
+
+struct strvec_block;
+
+/*
+ * One element of a string vector. Short strings are stored in the slot
+ * itself, so most tokens need no allocation of their own. Longer strings are
+ * stored in the vector's arena and the slot points to them; the last byte of
+ * the slot tells the two apart, since it is always 0 for an inline string.
+ */
+typedef union {
+    char inline_str[STRVEC_SLOT_SIZE];
+    struct {
+        char *str;
+        char unused[STRVEC_SLOT_SIZE - sizeof(char *) - 1];
+        char is_long;
+    } arena;
+} strvec_slot_t;
+
+/*
+ * Strings searched for, such as "|", are interned with strvec_intern(): a
+ * table shared by all vectors maps each of them to a small integer ID that
+ * stays the same for the life of the process. Vectors keep the ID of each
+ * element alongside it, or 0 if the element is not interned, so searching for
+ * a string hashes it once and then compares integers. Only the IDs interned
+ * before a vector was initialized are known to its elements; a search for a
+ * string interned later, or not at all, compares the strings instead.
+ */
 typedef struct {
     unsigned int length;
     unsigned int capacity;
-    char **data;
+    strvec_slot_t *slots;
+    uint32_t *ids;               // Interned ID of each element
+    uint32_t n_interned;         // IDs interned before the vector was initialized
+    char **argv;                 // Elements followed by NULL, if with_argv is set
+    struct strvec_block *arena;  // Blocks holding the long strings, newest first
+    arena_t *mem;                // Arena all memory comes from, or NULL for malloc
+    int is_view;                 // 1 if the elements belong to another vector
+    int with_argv;               // 1 if argv is kept up to date
 } strvec_t;
 
 /*
@@ -14,6 +55,54 @@ typedef struct {
  */
 int strvec_init(strvec_t *vec);
 
+/*
+ * Initializes a new, empty string vector that also keeps its elements in a
+ * NULL-terminated array, so it can be passed to exec without building one.
+ * The vector stays in this mode after being cleared.
+ * vec: Pointer to the vector to initialize
+ * Returns 0 on success, 1 on error
+ */
+int strvec_init_argv(strvec_t *vec);
+
+/*
+ * Initializes a new, empty string vector with room for a known number of
+ * elements, so adding them does not reallocate
+ * vec: Pointer to the vector to initialize
+ * size: Number of elements to allocate room for
+ * Returns 0 on success, 1 on error
+ */
+int strvec_init_size(strvec_t *vec, unsigned size);
+
+/*
+ * Initializes a new, empty string vector whose memory, including its long
+ * strings, is all allocated from an arena. The vector is only valid until
+ * the arena is reset; clearing it does nothing, and growing it leaves its
+ * old arrays in the arena.
+ * vec: Pointer to the vector to initialize
+ * arena: Pointer to the arena
+ * size: Number of elements to allocate room for
+ * with_argv: 1 to keep a NULL-terminated array as strvec_init_argv() does
+ * Returns 0 on success, 1 on error
+ */
+int strvec_init_arena(strvec_t *vec, arena_t *arena, unsigned size, int with_argv);
+
+/*
+ * Make room in a string vector for at least 'n' elements in total. A cleared
+ * vector is re-initialized with that room.
+ * vec: Pointer to the vector
+ * n: Number of elements to make room for
+ * Returns 0 on success, 1 on error
+ */
+int strvec_reserve(strvec_t *vec, unsigned n);
+
+/*
+ * Release the room a string vector has beyond its current elements, e.g.
+ * once a long-lived vector is complete
+ * vec: Pointer to the vector
+ * Returns 0 on success, 1 on error
+ */
+int strvec_shrink_to_fit(strvec_t *vec);
+
 /*
  * Removes all entries from a string vector
  * The underlying memory for the vector is also freed
@@ -36,9 +125,29 @@ int strvec_add(strvec_t *vec, const char *s);
  * vec: Pointer to the vector to retrieve from
  * i: Index of element to retrieve (starts at 0)
  * Returns the vector element (not a copy) on success, or NULL on error
+ * Note: Short elements live in the vector's own array, so the returned string
+ * may move when more strings are added to the vector
  */
 char *strvec_get(const strvec_t *vec, unsigned i);
 
+/*
+ * Retrieve the elements of a string vector as a NULL-terminated array
+ * vec: Pointer to the vector, initialized with strvec_init_argv(), or a view
+ *      of such a vector that ends at its end or at a separator it was split on
+ * Returns the array (not a copy), valid until the vector is modified, or NULL
+ * if the vector does not keep one
+ */
+char **strvec_argv(const strvec_t *vec);
+
+/*
+ * Intern a string that vectors are searched for, so that vectors initialized
+ * afterwards find it by comparing IDs. Adding elements and searching only
+ * look strings up, without locking, and never intern them.
+ * s: String to intern
+ * Returns 0 on success, 1 on error
+ */
+int strvec_intern(const char *s);
+
 /*
  * Search for a specific string within a string vector
  * vec: Pointer to the vector to search within
@@ -84,4 +193,55 @@ void strvec_take(strvec_t *vec, unsigned n);
  */
 int strvec_slice(const strvec_t *src, strvec_t *dest, int start, int end);
 
+/*
+ * Move the contents of one string vector to another, without copying
+ * dest: String vector that receives the contents. Any contents it had are
+ *       freed first.
+ * src: String vector to take the contents from. It is left cleared, and must
+ *      be re-initialized before it is used again.
+ */
+void strvec_move(strvec_t *dest, strvec_t *src);
+
+/*
+ * Construct a view of a sequence of consecutive elements of a string vector.
+ * Unlike a slice, the view shares the elements of the original vector: it is
+ * only valid while the original is neither modified nor cleared, and strings
+ * cannot be added to it. Clearing a view does not affect the original.
+ * src: String vector to construct a view of
+ * view: String vector data structure in which to store the view. You do not
+ *       need to initialize this vector beforehand.
+ * start: The starting index of the view (inclusive)
+ * end: The ending index of the view (exclusive)
+ */
+void strvec_view(const strvec_t *src, strvec_t *view, int start, int end);
+
+/*
+ * Split a string vector into views of the elements between occurrences of a
+ * separator, e.g. the stages of a pipeline between "|" tokens. If the vector
+ * keeps an argv array, the separators' entries in it are set to NULL, so each
+ * view is NULL-terminated as well.
+ * src: String vector to split
+ * sep: The separator
+ * arena: Arena to allocate the array of views from, or NULL
+ * views: Receives an array of one view per part, to be freed with free()
+ *        unless it came from an arena
+ * n_views: Receives the number of views (one more than the number of separators)
+ * Returns 0 on success, 1 on error
+ */
+int strvec_split_on(strvec_t *src, const char *sep, arena_t *arena, strvec_t **views, unsigned *n_views);
+
+/*
+ * Sort the elements of a string vector in strcmp order, by MSD radix sort
+ * vec: Pointer to the vector to sort (not a view)
+ * Returns 0 on success, 1 on error
+ */
+int strvec_sort(strvec_t *vec);
+
+/*
+ * Remove consecutive duplicate elements of a string vector, which removes
+ * all duplicates from a sorted vector
+ * vec: Pointer to the vector (not a view)
+ */
+void strvec_dedupe(strvec_t *vec);
+
 #endif // STRING_VECTOR_H
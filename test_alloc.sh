@@ -0,0 +1,34 @@
+#!/bin/sh
+# Checks that the shell makes no heap allocation per command line once lines
+# of a given size have been seen: it runs N and then 2N pipelines, every one
+# with arguments it has not seen before, and must make the same number of
+# allocations both times. Counted with alloc_count.so, in --echo mode.
+
+n=100
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# Print 'count' distinct command lines, all of the same length
+lines() {
+    i=1
+    while [ "$i" -le "$1" ]; do
+        printf 'echo arg%04d word%04d | tr a-z A-Z | cat > /dev/null\n' "$i" "$i"
+        printf 'ls -d /tmp/missing%04d | cat 2> /dev/null\n' "$i"
+        i=$((i + 1))
+    done
+}
+
+# Print the number of allocations made running 'count' lines
+count() {
+    lines "$1" > "$dir/in"
+    ALLOC_COUNT_FILE="$dir/count" LD_PRELOAD=./alloc_count.so ./shell --echo < "$dir/in" > /dev/null 2>&1
+    cat "$dir/count"
+}
+
+first=$(count $n) || exit 1
+second=$(count $((2 * n))) || exit 1
+if [ "$first" != "$second" ]; then
+    echo "FAIL: $((2 * n)) lines made $second allocations, $n lines made $first"
+    exit 1
+fi
+echo "PASS: $((2 * n)) lines made as many allocations as $n ($first)"
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "string_vector.h"
+
+/*
+ * Checks strvec_sort() and strvec_dedupe() against qsort() with strcmp() on
+ * random names and on names with many duplicates, at sizes that exercise
+ * insertion sort, multikey quicksort and both widths of radix sort, and
+ * prints how long each sort of the largest input took.
+ */
+
+#define LARGE_SIZE 2000000
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * Write a random name to 'buf': a prefix shared by many names, some of them
+ * longer than a slot or a sort key, then a number drawn from 'distinct'
+ * values, and sometimes bytes of UTF-8
+ */
+static void random_name(char *buf, size_t size, unsigned distinct) {
+    static const char *prefixes[] = {"", "lib", "file_", "x", "src/components/widgets/", "\xc3\xa9t\xc3\xa9_"};
+    static const char *suffixes[] = {"", ".c", ".png", "-very-long-suffix-beyond-an-inline-slot"};
+    snprintf(buf, size, "%s%x%s", prefixes[rand() % 6], (unsigned) rand() % distinct, suffixes[rand() % 4]);
+}
+
+/*
+ * Sort 'n' random names both ways and compare the results
+ * distinct: Number of values the numbers in the names are drawn from
+ * with_argv: 1 to check the argv array of the vector as well
+ * timed: 1 to print how long both sorts took
+ * Returns 0 if they match, 1 otherwise
+ */
+static int check(unsigned n, unsigned distinct, int with_argv, int timed) {
+    strvec_t vec;
+    if ((with_argv ? strvec_init_argv(&vec) : strvec_init_size(&vec, n)) != 0) {
+        return 1;
+    }
+    char **expected = malloc((n > 0 ? n : 1) * sizeof(char *));
+    if (expected == NULL) {
+        return 1;
+    }
+    char buf[128];
+    for (unsigned i = 0; i < n; i++) {
+        random_name(buf, sizeof(buf), distinct);
+        if (strvec_add(&vec, buf) != 0 || (expected[i] = strdup(buf)) == NULL) {
+            return 1;
+        }
+    }
+    struct timespec start, middle, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = strvec_sort(&vec);
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    qsort(expected, n, sizeof(char *), compare_strings);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (timed) {
+        printf("%u names, %u distinct values: strvec_sort %.1f ms, qsort %.1f ms\n", n, distinct,
+               elapsed_ms(&start, &middle), elapsed_ms(&middle, &end));
+    }
+
+    for (unsigned i = 0; ret == 0 && i < n; i++) {
+        if (strcmp(strvec_get(&vec, i), expected[i]) != 0 || (with_argv && strvec_argv(&vec)[i] != strvec_get(&vec, i))) {
+            printf("FAIL: %u names, %u distinct: element %u is '%s', expected '%s'\n", n, distinct, i,
+                   strvec_get(&vec, i), expected[i]);
+            ret = 1;
+        }
+    }
+
+    strvec_dedupe(&vec);
+    unsigned unique = 0;
+    for (unsigned i = 0; ret == 0 && i < n; i++) {
+        if (i > 0 && strcmp(expected[i], expected[i - 1]) == 0) {
+            continue;
+        }
+        if (unique >= vec.length || strcmp(strvec_get(&vec, unique), expected[i]) != 0) {
+            printf("FAIL: %u names, %u distinct: deduped element %u is wrong\n", n, distinct, unique);
+            ret = 1;
+        }
+        unique++;
+    }
+    if (ret == 0 && (unique != vec.length || (with_argv && strvec_argv(&vec)[unique] != NULL))) {
+        printf("FAIL: %u names, %u distinct: %u unique, deduped to %u\n", n, distinct, unique, vec.length);
+        ret = 1;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+        free(expected[i]);
+    }
+    free(expected);
+    strvec_clear(&vec);
+    return ret;
+}
+
+int main(void) {
+    static const unsigned sizes[] = {0, 1, 2, 7, 8, 63, 64, 1000, 70000};
+    srand(1);
+    // An interned string gives some elements IDs and leaves others without
+    if (strvec_intern("lib1") != 0) {
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned n = sizes[i];
+        // Random names, and names with many duplicates
+        ret |= check(n, 1u << 30, 0, 0);
+        ret |= check(n, 1 + n / 50, 1, 0);
+    }
+    ret |= check(LARGE_SIZE, 1u << 30, 0, 1);
+    ret |= check(LARGE_SIZE, 1000, 0, 1);
+    if (ret == 0) {
+        printf("PASS\n");
+    }
+    return ret;
+}
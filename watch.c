@@ -0,0 +1,341 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "watch.h"
+
+#define READ_SIZE 4096
+#define TAB_WIDTH 8
+// Bytes a row can take: a character may be up to 4 bytes of UTF-8
+#define MAX_CONTINUATION 3
+#define ROW_BYTES(cols) ((MAX_CONTINUATION + 1) * (size_t) (cols) + 1)
+#define HEADER_ROWS 2
+
+// The text of each row of the screen, as shown
+typedef struct {
+    int rows;
+    int cols;
+    char *text;  // 'rows' rows of ROW_BYTES(cols) bytes, each NUL-terminated
+} frame_t;
+
+// Output waiting to be written to the terminal
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} out_buf_t;
+
+static volatile sig_atomic_t interrupted;
+
+static void on_interrupt(int sig) {
+    interrupted = 1;
+}
+
+static char *row_text(const frame_t *f, int row) {
+    return f->text + row * ROW_BYTES(f->cols);
+}
+
+/*
+ * Make a frame the given size, with every row empty
+ * Returns 0 on success, 1 on error
+ */
+static int frame_resize(frame_t *f, int rows, int cols) {
+    if (rows != f->rows || cols != f->cols) {
+        char *text = malloc(rows * ROW_BYTES(cols));
+        if (text == NULL) {
+            return 1;
+        }
+        free(f->text);
+        f->text = text;
+        f->rows = rows;
+        f->cols = cols;
+    }
+    for (int row = 0; row < f->rows; row++) {
+        row_text(f, row)[0] = '\0';
+    }
+    return 0;
+}
+
+static int out_append(out_buf_t *out, const char *s, size_t n) {
+    if (out->len + n > out->cap) {
+        size_t new_cap = out->cap == 0 ? READ_SIZE : out->cap;
+        while (new_cap < out->len + n) {
+            new_cap *= 2;
+        }
+        char *new_data = realloc(out->data, new_cap);
+        if (new_data == NULL) {
+            return 1;
+        }
+        out->data = new_data;
+        out->cap = new_cap;
+    }
+    memcpy(out->data + out->len, s, n);
+    out->len += n;
+    return 0;
+}
+
+static void out_flush(out_buf_t *out) {
+    size_t written = 0;
+    while (written < out->len) {
+        ssize_t n = write(STDOUT_FILENO, out->data + written, out->len - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += n;
+    }
+    out->len = 0;
+}
+
+// Where the output of a command is being laid out
+struct layout {
+    int row;
+    int col;
+    size_t len;      // Bytes in the current row
+    int trailing;    // Continuation bytes kept for the last character
+    int skipping;    // Set while dropping the rest of a line that is too long
+    int escape;      // 1 after an ESC, 2 inside a control sequence
+};
+
+/*
+ * Lay out the output of a command in the rows of a frame below the header.
+ * Lines are cut at the width of the screen, tabs are expanded, and escape
+ * sequences (e.g. colors) and other control characters are dropped. Output
+ * past the last row is read but not kept.
+ */
+static void layout_bytes(frame_t *f, struct layout *l, const char *buf, size_t n) {
+    // Every column holds at most 1 + MAX_CONTINUATION bytes, so a row never
+    // needs more, but each store is still checked against the room left
+    size_t room = ROW_BYTES(f->cols) - 1;
+    for (size_t i = 0; i < n && l->row < f->rows; i++) {
+        unsigned char c = buf[i];
+        char *text = row_text(f, l->row);
+        if (l->escape == 1) {
+            l->escape = c == '[' ? 2 : 0;
+        } else if (l->escape == 2) {
+            if (c >= 0x40 && c <= 0x7e) {
+                l->escape = 0;
+            }
+        } else if (c == 0x1b) {
+            l->escape = 1;
+        } else if (c == '\n') {
+            text[l->len] = '\0';
+            l->row++;
+            l->col = 0;
+            l->len = 0;
+            l->trailing = 0;
+            l->skipping = 0;
+        } else if (c == '\t') {
+            while (l->col < f->cols && l->len < room) {
+                text[l->len++] = ' ';
+                l->col++;
+                l->trailing = 0;
+                if (l->col % TAB_WIDTH == 0) {
+                    break;
+                }
+            }
+        } else if (c < 0x20 || c == 0x7f) {
+            continue;
+        } else if ((c & 0xc0) == 0x80) {
+            // UTF-8 continuation bytes take no column of their own; a
+            // character has at most MAX_CONTINUATION of them
+            if (!l->skipping && l->len > 0 && l->trailing < MAX_CONTINUATION && l->len < room) {
+                text[l->len++] = c;
+                l->trailing++;
+            }
+        } else if (l->col < f->cols && l->len < room) {
+            text[l->len++] = c;
+            l->col++;
+            l->trailing = 0;
+            l->skipping = 0;
+        } else {
+            l->skipping = 1;
+        }
+    }
+    if (l->row < f->rows) {
+        row_text(f, l->row)[l->len] = '\0';
+    }
+}
+
+/*
+ * Read everything a pipeline writes to its output pipe into a frame
+ * Returns 0 on success, 1 on error
+ */
+static int read_output(frame_t *f, int fd) {
+    struct layout l = {HEADER_ROWS, 0, 0, 0, 0, 0};
+    char buf[READ_SIZE];
+    while (1) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        layout_bytes(f, &l, buf, n);
+    }
+}
+
+static void format_header(frame_t *f, double interval, const char *title) {
+    char *text = row_text(f, 0);
+    char when[64];
+    time_t now = time(NULL);
+    strftime(when, sizeof(when), "%a %b %e %H:%M:%S %Y", localtime(&now));
+
+    char left[ROW_BYTES(f->cols)];
+    int len = snprintf(left, sizeof(left), "Every %gs: %s", interval, title);
+    if (len >= f->cols) {
+        len = f->cols;
+    }
+    int when_len = strlen(when);
+    if (len + 2 + when_len <= f->cols) {
+        snprintf(text, ROW_BYTES(f->cols), "%.*s%*s", len, left, f->cols - len, when);
+    } else {
+        snprintf(text, ROW_BYTES(f->cols), "%.*s", len, left);
+    }
+}
+
+/*
+ * Bring the screen from showing 'old' to showing 'new', rewriting only the
+ * rows that differ. The whole screen is redrawn if the frames differ in size.
+ */
+static void redraw(const frame_t *old, frame_t *new, out_buf_t *out) {
+    int full = old->rows != new->rows || old->cols != new->cols;
+    if (full) {
+        out_append(out, "\x1b[H\x1b[2J", 7);
+    }
+    for (int row = 0; row < new->rows; row++) {
+        const char *text = row_text(new, row);
+        if (full ? text[0] == '\0' : strcmp(text, row_text(old, row)) == 0) {
+            continue;
+        }
+        char move[32];
+        int n = snprintf(move, sizeof(move), "\x1b[%d;1H", row + 1);
+        out_append(out, move, n);
+        out_append(out, text, strlen(text));
+        out_append(out, "\x1b[K", 3);
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Sleep until a time on the monotonic clock, or until interrupted
+ */
+static void sleep_until(double deadline) {
+    double left = deadline - now_seconds();
+    if (left <= 0) {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (time_t) left;
+    ts.tv_nsec = (long) ((left - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+int watch_run(pipeline_t *p, exec_cache_t *exec_cache, double interval, const char *title) {
+    int tty = isatty(STDOUT_FILENO);
+
+    // Ctrl-C stops the command being run and then the watch, not the shell
+    struct sigaction action, old_action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_interrupt;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    interrupted = 0;
+    sigaction(SIGINT, &action, &old_action);
+
+    // The screen shows 'shown'; each run is laid out in 'next' and the two
+    // are swapped once it is drawn
+    frame_t shown = {0, 0, NULL};
+    frame_t next = {0, 0, NULL};
+    out_buf_t out = {NULL, 0, 0};
+    if (tty) {
+        // The alternate screen gives the terminal back as it was afterwards
+        out_append(&out, "\x1b[?1049h\x1b[?25l", 14);
+    }
+
+    int ret = 0;
+    double start = now_seconds();
+    while (!interrupted) {
+        int rows = 24;
+        int cols = 80;
+        struct winsize ws;
+        if (tty && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+            rows = ws.ws_row;
+            cols = ws.ws_col;
+        }
+        if (frame_resize(&next, rows, cols) != 0) {
+            perror("watch");
+            ret = 1;
+            break;
+        }
+
+        if (start_pipeline(p, exec_cache, 1) != 0) {
+            ret = 1;
+            break;
+        }
+        int read_failed = read_output(&next, p->out_fd);
+        close(p->out_fd);
+        wait_pipeline(p);
+        if (read_failed) {
+            perror("watch");
+            ret = 1;
+            break;
+        }
+        if (interrupted) {
+            break;
+        }
+
+        format_header(&next, interval, title);
+        if (tty) {
+            redraw(&shown, &next, &out);
+            frame_t tmp = shown;
+            shown = next;
+            next = tmp;
+        } else {
+            int used = next.rows;
+            while (used > 1 && row_text(&next, used - 1)[0] == '\0') {
+                used--;
+            }
+            for (int row = 0; row < used; row++) {
+                const char *text = row_text(&next, row);
+                out_append(&out, text, strlen(text));
+                out_append(&out, "\n", 1);
+            }
+        }
+        out_flush(&out);
+
+        // Runs start at fixed intervals, however long each took
+        start += interval;
+        if (start < now_seconds()) {
+            start = now_seconds();
+        }
+        sleep_until(start);
+    }
+
+    if (tty) {
+        out_append(&out, "\x1b[?25h\x1b[?1049l", 14);
+        out_flush(&out);
+    }
+    free(out.data);
+    free(shown.text);
+    free(next.text);
+    sigaction(SIGINT, &old_action, NULL);
+    return ret;
+}
@@ -0,0 +1,21 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "exec_cache.h"
+#include "shell_funcs.h"
+
+/*
+ * Run a planned pipeline every 'interval' seconds and show its output full
+ * screen, until interrupted with Ctrl-C. The pipeline is only planned once,
+ * so each run forks its commands straight from the plan, and only the rows
+ * of the screen whose text changed since the previous run are redrawn. When
+ * standard output is not a terminal, each run's output is printed in full.
+ * p: Pointer to the pipeline
+ * exec_cache: Pointer to the cache of open programs
+ * interval: Seconds between the starts of two runs
+ * title: Command line shown in the header
+ * Returns 0 on success, 1 on error
+ */
+int watch_run(pipeline_t *p, exec_cache_t *exec_cache, double interval, const char *title);
+
+#endif // WATCH_H